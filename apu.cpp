@@ -1,6 +1,9 @@
 #include <algorithm>
+#include <limits>
+#include <cmath>
 #include <memory>
 #include <cstdint>
+#include <cstring>
 #include <cassert>
 
 #include "junknes.h"
@@ -9,6 +12,29 @@
 
 using namespace std;
 
+namespace{
+    array<float, 31> makeMixPulse()
+    {
+        array<float, 31> table;
+        table[0] = 0;
+        for(int i = 1; i < 31; ++i)
+            table[i] = 95.52 / (8128.0/i + 100);
+        return table;
+    }
+
+    array<float, 203> makeMixTnd()
+    {
+        array<float, 203> table;
+        table[0] = 0;
+        for(int i = 1; i < 203; ++i)
+            table[i] = 163.67 / (24329.0/i + 100);
+        return table;
+    }
+}
+
+const array<float, 31>  APU_MIX_PULSE = makeMixPulse();
+const array<float, 203> APU_MIX_TND   = makeMixTnd();
+
 namespace{
     constexpr uint8_t LENGTH_TABLE[0x20] = {
         10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
@@ -64,6 +90,18 @@ void Apu::tick(int cycle)
     soundTimestamp_ += cycle;
 }
 
+/**
+ * 次にイベント(フレームカウンタのstep、DMCのDMA)が起こるまでのCPUサイクル数
+ *
+ * tick() に渡すサイクル数の累計がこの値に達した tick() でイベントが起こ
+ * る。それ未満であれば tick() を何回に分けて呼んでも結果は同じ
+ */
+int Apu::nextEvent() const
+{
+    int frame = (restCycle_ + 47) / 48;
+    return min(frame, dmc_.nextEvent());
+}
+
 
 void Apu::updateStep()
 {
@@ -546,7 +584,7 @@ void Apu::Dmc::tick(int cycle, int sound_timestamp)
     timestamp_ -= cycle;
     while(timestamp_ < 0){
         if(out_.rest_bits){
-            genSound(sound_timestamp + timestamp_); // CPUに対する遅れを補正
+            genSound(sound_timestamp + cycle + timestamp_); // CPUに対する遅れを補正
 
             bool bit = out_.reg & 1;
             if(bit && out_.level <= 0x7D)
@@ -569,6 +607,18 @@ void Apu::Dmc::tick(int cycle, int sound_timestamp)
     }
 }
 
+int Apu::Dmc::nextEvent() const
+{
+    // DMA待ち
+    if(reader_.size && !reader_.has_sample) return 0;
+
+    // サンプルがシフトレジスタに読み込まれると次の tick() でDMAが起こる
+    if(reader_.has_sample)
+        return timestamp_ + out_.rest_bits*DMC_PERIOD_TABLE[periodReg_] + 1;
+
+    return numeric_limits<int>::max();
+}
+
 void Apu::Dmc::write4010(uint8_t value, int timestamp)
 {
     genSound(timestamp);
@@ -677,6 +727,129 @@ void Apu::write4017(uint8_t value)
 // 以下、音声出力の実装(超適当)
 //---------------------------------------------------------------------
 
+namespace{
+    constexpr double CPU_FREQ = 6.0 * 39375000.0/11.0 / 12.0;
+
+    // 1F内のCPUサイクルの上限(sound_ のサイズと同じ)
+    constexpr int FRAME_CYCLE_MAX = 40000;
+
+    // 出力レベル1.0あたりの振幅(int16_t)。junknes_mixer_push() と同じ
+    constexpr float SYNTH_AMP = 20000;
+}
+
+Apu::Synth::Synth(int sample_rate)
+    : blip_(CPU_FREQ, sample_rate, FRAME_CYCLE_MAX), amp_(0)
+{
+    levels_.fill(0);
+}
+
+uint8_t Apu::Synth::level(int ch) const
+{
+    return levels_[ch];
+}
+
+void Apu::Synth::update(int ch, int time, uint8_t level)
+{
+    if(level == levels_[ch]) return;
+    levels_[ch] = level;
+
+    // 非線形なので他チャンネルのレベルも込みでミックスし直して差分を取
+    // る(他チャンネルが未出力の変化を持っていても、差分の総和は正しい)
+    float mixed = APU_MIX_PULSE[levels_[SQ1] + levels_[SQ2]] +
+                  APU_MIX_TND[3*levels_[TRI] + 2*levels_[NOI] + levels_[DMC]];
+    int amp = lround(SYNTH_AMP * mixed);
+    blip_.addDelta(time, amp - amp_);
+    amp_ = amp;
+}
+
+void Apu::Synth::endFrame(int time)
+{
+    blip_.endFrame(time);
+}
+
+int Apu::Synth::readSamples(int16_t* out, int max)
+{
+    return blip_.readSamples(out, max);
+}
+
+namespace{
+    // genSoundTo() の出力先。fill() は [from,to) を同じ値で埋める
+
+    // CPUサイクルごとのサンプル列
+    struct ArraySink{
+        uint8_t* buf;
+        void fill(int from, int to, uint8_t value) { if(from < to) memset(buf+from, value, to-from); }
+    };
+
+    // 帯域制限合成。レベルが変化した時刻だけが意味を持つ
+    // 直前のレベルを手元に持っておき、変化した時だけ Synth を呼ぶ
+    template<typename Synth>
+    struct SynthSink{
+        Synth* synth;
+        int ch;
+        uint8_t last;
+        void put(int pos, uint8_t value)
+        {
+            if(value == last) return;
+            synth->update(ch, pos, value);
+            last = value;
+        }
+        void fill(int from, int to, uint8_t value) { if(from < to) put(from, value); }
+    };
+    template<typename Synth>
+    SynthSink<Synth> synthSink(Synth* synth, int ch)
+    {
+        return SynthSink<Synth>{ synth, ch, synth->level(ch) };
+    }
+
+    /**
+     * タイマの値が timer のとき、出力が変わらないサイクル数(最大 rest)
+     * タイマは 0 になったサイクルの後でリロードされ、出力が変わる。呼び
+     * 出し側は返り値の分だけ進めた後、timer_ が 0 ならリロード、そうで
+     * なければ1減らす(1サイクルずつ回していた時の最後のサイクルに相当)
+     */
+    int spanLen(unsigned int& timer, int rest)
+    {
+        if(timer < static_cast<unsigned int>(rest)){
+            int len = timer + 1;
+            timer = 0;
+            return len;
+        }
+        timer -= rest - 1;
+        return rest;
+    }
+}
+
+void Apu::setSampleRate(int sample_rate)
+{
+    if(sample_rate > 0)
+        synth_.reset(new Synth(sample_rate));
+    else
+        synth_.reset();
+
+    sq1_.setSynth(synth_.get());
+    sq2_.setSynth(synth_.get());
+    tri_.setSynth(synth_.get());
+    noi_.setSynth(synth_.get());
+    dmc_.setSynth(synth_.get());
+}
+
+int Apu::readSamples(int16_t* out, int max)
+{
+    return synth_ ? synth_->readSamples(out, max) : 0;
+}
+
+void Apu::setSoundOff(bool off)
+{
+    soundOff_ = off;
+
+    sq1_.setSoundOff(off);
+    sq2_.setSoundOff(off);
+    tri_.setSoundOff(off);
+    noi_.setSoundOff(off);
+    dmc_.setSoundOff(off);
+}
+
 void Apu::startFrame()
 {
     soundTimestamp_ = 0;
@@ -694,6 +867,8 @@ void Apu::endFrame()
     tri_.genSound(soundTimestamp_);
     noi_.genSound(soundTimestamp_);
     dmc_.genSound(soundTimestamp_);
+
+    if(synth_ && !soundOff_) synth_->endFrame(soundTimestamp_);
 }
 
 JunknesSoundChannel Apu::soundSq1() const
@@ -729,7 +904,17 @@ void Apu::Square::startFrame()
 
 JunknesSoundChannel Apu::Square::sound() const
 {
-    return JunknesSoundChannel{ soundPos_, sound_.data() };
+    return JunknesSoundChannel{ synth_ || soundOff_ ? 0 : soundPos_, sound_.data() };
+}
+
+void Apu::Square::setSynth(Synth* synth)
+{
+    synth_ = synth;
+}
+
+void Apu::Square::setSoundOff(bool off)
+{
+    soundOff_ = off;
 }
 
 namespace{
@@ -755,19 +940,33 @@ bool Apu::Square::checkFreq()
 }
 
 void Apu::Square::genSound(int timestamp)
+{
+    // 出力しないならタイマも回さない(CPUからは見えない)
+    if(soundOff_)
+        soundPos_ = timestamp;
+    else if(synth_)
+        genSoundTo(timestamp, synthSink(synth_, which_==Ch::SQ1 ? Synth::SQ1 : Synth::SQ2));
+    else
+        genSoundTo(timestamp, ArraySink{ sound_.data() });
+}
+
+template<typename Sink>
+void Apu::Square::genSoundTo(int timestamp, Sink sink)
 {
     assert(soundPos_ <= timestamp);
 
     if(!(8 <= timerReg_.raw && timerReg_.raw <= 0x7FF) ||
        !checkFreq() ||
        !length_){ // silenced
-        fill(sound_.begin()+soundPos_, sound_.begin()+timestamp, 0);
+        sink.fill(soundPos_, timestamp, 0);
         soundPos_ = timestamp;
     }
     else{
         uint8_t amp = envelope_.constant ? envelope_.volume : envelope_.decay_level;
-        for(; soundPos_ < timestamp; ++soundPos_){
-            sound_[soundPos_] = amp * SQ_DUTIES[duty_][step_];
+        while(soundPos_ < timestamp){
+            int len = spanLen(timer_, timestamp-soundPos_);
+            sink.fill(soundPos_, soundPos_+len, amp * SQ_DUTIES[duty_][step_]);
+            soundPos_ += len;
             if(!timer_){
                 timer_ = 2*timerReg_.raw + 1; // 周期はCPUサイクル単位で 2*(t+1) だから…
                 step_ = (step_+1) & 7;
@@ -787,7 +986,17 @@ void Apu::Triangle::startFrame()
 
 JunknesSoundChannel Apu::Triangle::sound() const
 {
-    return JunknesSoundChannel{ soundPos_, sound_.data() };
+    return JunknesSoundChannel{ synth_ || soundOff_ ? 0 : soundPos_, sound_.data() };
+}
+
+void Apu::Triangle::setSynth(Synth* synth)
+{
+    synth_ = synth;
+}
+
+void Apu::Triangle::setSoundOff(bool off)
+{
+    soundOff_ = off;
 }
 
 namespace{
@@ -801,13 +1010,26 @@ namespace{
 }
 
 void Apu::Triangle::genSound(int timestamp)
+{
+    if(soundOff_)
+        soundPos_ = timestamp;
+    else if(synth_)
+        genSoundTo(timestamp, synthSink(synth_, Synth::TRI));
+    else
+        genSoundTo(timestamp, ArraySink{ sound_.data() });
+}
+
+template<typename Sink>
+void Apu::Triangle::genSoundTo(int timestamp, Sink sink)
 {
     assert(soundPos_ <= timestamp);
 
     if(length_ && linear_){
         uint8_t output = TRI_OUTPUT(step_);
-        for(; soundPos_ < timestamp; ++soundPos_){
-            sound_[soundPos_] = output;
+        while(soundPos_ < timestamp){
+            int len = spanLen(timer_, timestamp-soundPos_);
+            sink.fill(soundPos_, soundPos_+len, output);
+            soundPos_ += len;
             if(!timer_){
                 // step_ はどうせ下位5bitしか見ないので、ここでのマス
                 // クは必要ない。オーバーフローしても問題なく動くはず
@@ -821,7 +1043,7 @@ void Apu::Triangle::genSound(int timestamp)
         }
     }
     else{ // silenced
-        fill(sound_.begin()+soundPos_, sound_.begin()+timestamp, 0);
+        sink.fill(soundPos_, timestamp, 0);
         soundPos_ = timestamp;
     }
 }
@@ -834,7 +1056,17 @@ void Apu::Noise::startFrame()
 
 JunknesSoundChannel Apu::Noise::sound() const
 {
-    return JunknesSoundChannel{ soundPos_, sound_.data() };
+    return JunknesSoundChannel{ synth_ || soundOff_ ? 0 : soundPos_, sound_.data() };
+}
+
+void Apu::Noise::setSynth(Synth* synth)
+{
+    synth_ = synth;
+}
+
+void Apu::Noise::setSoundOff(bool off)
+{
+    soundOff_ = off;
 }
 
 void Apu::Noise::Lfsr::shift()
@@ -853,6 +1085,17 @@ namespace{
 }
 
 void Apu::Noise::genSound(int timestamp)
+{
+    if(soundOff_)
+        soundPos_ = timestamp;
+    else if(synth_)
+        genSoundTo(timestamp, synthSink(synth_, Synth::NOI));
+    else
+        genSoundTo(timestamp, ArraySink{ sound_.data() });
+}
+
+template<typename Sink>
+void Apu::Noise::genSoundTo(int timestamp, Sink sink)
 {
     assert(soundPos_ <= timestamp);
 
@@ -861,8 +1104,10 @@ void Apu::Noise::genSound(int timestamp)
     // length counterが0であってもタイマは回さなければならないらしい
     // (FCEUXを読む限りでは)
     uint8_t out = (lfsr_.reg&1) ? 0 : amp;
-    for(; soundPos_ < timestamp; ++soundPos_){
-        sound_[soundPos_] = length_ ? out : 0;
+    while(soundPos_ < timestamp){
+        int len = spanLen(timer_, timestamp-soundPos_);
+        sink.fill(soundPos_, soundPos_+len, length_ ? out : 0);
+        soundPos_ += len;
         // FCEUXではタイマが1->0のときにLFSRを更新してるけど、これだと
         // 周期が1ずれるんじゃないかな…
         if(!timer_){
@@ -884,12 +1129,32 @@ void Apu::Dmc::startFrame()
 
 JunknesSoundChannel Apu::Dmc::sound() const
 {
-    return JunknesSoundChannel{ soundPos_, sound_.data() };
+    return JunknesSoundChannel{ synth_ || soundOff_ ? 0 : soundPos_, sound_.data() };
+}
+
+void Apu::Dmc::setSynth(Synth* synth)
+{
+    synth_ = synth;
+}
+
+void Apu::Dmc::setSoundOff(bool off)
+{
+    soundOff_ = off;
 }
 
 void Apu::Dmc::genSound(int timestamp)
 {
-    for(; soundPos_ < timestamp; ++soundPos_){
-        sound_[soundPos_] = out_.level;
-    }
+    if(soundOff_)
+        soundPos_ = max(soundPos_, timestamp);
+    else if(synth_)
+        genSoundTo(timestamp, synthSink(synth_, Synth::DMC));
+    else
+        genSoundTo(timestamp, ArraySink{ sound_.data() });
+}
+
+template<typename Sink>
+void Apu::Dmc::genSoundTo(int timestamp, Sink sink)
+{
+    sink.fill(soundPos_, timestamp, out_.level);
+    soundPos_ = max(soundPos_, timestamp);
 }
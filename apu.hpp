@@ -5,8 +5,17 @@
 #include <cstdint>
 
 #include "junknes.h"
+#include "blip.hpp"
 #include "util.hpp"
 
+/**
+ * 非線形ミキサのテーブル(http://wiki.nesdev.com/w/index.php/APU_Mixer)
+ * APU_MIX_PULSE[sq1+sq2] + APU_MIX_TND[3*tri + 2*noi + dmc] が出力レベル
+ * (範囲は [0,1))
+ */
+extern const std::array<float, 31>  APU_MIX_PULSE;
+extern const std::array<float, 203> APU_MIX_TND;
+
 class Apu{
 public:
     class Door{
@@ -23,6 +32,7 @@ public:
     void softReset();
 
     void tick(int cycle /* CPU cycle */);
+    int nextEvent() const;
 
     std::uint8_t read4015();
     void write4000(std::uint8_t value);
@@ -54,6 +64,16 @@ public:
     JunknesSoundChannel soundNoi() const;
     JunknesSoundChannel soundDmc() const;
 
+    // 帯域制限合成モード(sample_rate <= 0 なら無効)
+    // 有効な間は sound*() のサンプル列は空になり、代わりに readSamples()
+    // で出力レートのサンプルを読み出す
+    void setSampleRate(int sample_rate);
+    int readSamples(std::int16_t* out, int max);
+
+    // 音声出力を一切生成しない(レジスタ、length counter、IRQ、DMCの
+    // DMAは通常通り動作する)。有効な間は sound*() のサンプル列は空
+    void setSoundOff(bool off);
+
 private:
     void updateStep();
     void frameQuarter();
@@ -61,6 +81,28 @@ private:
 
     std::shared_ptr<Door> door_;
 
+    /**
+     * 帯域制限合成
+     * チャンネルは出力レベルが変化した時刻に update() を呼ぶだけで、CPU
+     * サイクルごとのサンプル列は作らない。ミックス後の振幅の差分を
+     * BlipBuffer に加える
+     */
+    class Synth{
+    public:
+        enum Ch { SQ1, SQ2, TRI, NOI, DMC };
+        explicit Synth(int sample_rate);
+        std::uint8_t level(int ch) const;
+        void update(int ch, int time, std::uint8_t level);
+        void endFrame(int time);
+        int readSamples(std::int16_t* out, int max);
+    private:
+        BlipBuffer blip_;
+        std::array<std::uint8_t, 5> levels_;
+        int amp_; // levels_ をミックスした振幅
+    };
+    std::unique_ptr<Synth> synth_;
+    bool soundOff_ = false;
+
     class Square{
     public:
         enum class Ch { SQ1, SQ2 };
@@ -80,7 +122,11 @@ private:
         void startFrame();
         void genSound(int timestamp);
         JunknesSoundChannel sound() const;
+        void setSynth(Synth* synth);
+        void setSoundOff(bool off);
     private:
+        template<typename Sink> void genSoundTo(int timestamp, Sink sink);
+
         bool checkFreq();
 
         const Ch which_;
@@ -123,6 +169,8 @@ private:
 
         std::array<std::uint8_t, 40000> sound_; // 各要素は [0,15]
         int soundPos_; // CPU cycle
+        Synth* synth_ = nullptr; // 帯域制限合成(無効なら nullptr)
+        bool soundOff_ = false;  // 出力を生成しない(setSoundOff())
     };
     Square sq1_, sq2_;
 
@@ -142,7 +190,11 @@ private:
         void startFrame();
         void genSound(int timestamp);
         JunknesSoundChannel sound() const;
+        void setSynth(Synth* synth);
+        void setSoundOff(bool off);
     private:
+        template<typename Sink> void genSoundTo(int timestamp, Sink sink);
+
         bool enabled_;
         unsigned int timer_; // CPU cycle
 
@@ -170,6 +222,8 @@ private:
         // ても絶対足りるはず(数値自体はFCEUXのパクリ)。
         std::array<std::uint8_t, 40000> sound_; // 各要素は [0,15]
         int soundPos_; // CPU cycle
+        Synth* synth_ = nullptr;
+        bool soundOff_ = false;
     };
     Triangle tri_;
 
@@ -188,7 +242,11 @@ private:
         void startFrame();
         void genSound(int timestamp);
         JunknesSoundChannel sound() const;
+        void setSynth(Synth* synth);
+        void setSoundOff(bool off);
     private:
+        template<typename Sink> void genSoundTo(int timestamp, Sink sink);
+
         bool enabled_;
         unsigned int timer_;
         unsigned int timerReg_; // $400E bit3-0
@@ -214,6 +272,8 @@ private:
 
         std::array<std::uint8_t, 40000> sound_; // 各要素は [0,15]
         int soundPos_; // CPU cycle
+        Synth* synth_ = nullptr;
+        bool soundOff_ = false;
     };
     Noise noi_;
 
@@ -226,6 +286,7 @@ private:
         bool isActive() const;
         bool irqEnabled() const;
         void tick(int cycle, int sound_timestamp);
+        int nextEvent() const;
         void write4010(std::uint8_t value, int timestamp);
         void write4011(std::uint8_t value, int timestamp);
         void write4012(std::uint8_t value, int timestamp);
@@ -234,7 +295,11 @@ private:
         void startFrame();
         void genSound(int timestamp);
         JunknesSoundChannel sound() const;
+        void setSynth(Synth* synth);
+        void setSoundOff(bool off);
     private:
+        template<typename Sink> void genSoundTo(int timestamp, Sink sink);
+
         const std::shared_ptr<Door>& door_;
 
         bool irq_;
@@ -262,6 +327,8 @@ private:
 
         std::array<std::uint8_t, 40000> sound_; // 各要素は [0,127]
         int soundPos_; // CPU cycle
+        Synth* synth_ = nullptr;
+        bool soundOff_ = false;
     };
     Dmc dmc_;
 
@@ -0,0 +1,268 @@
+/**
+ * マイクロベンチマーク(scons bench)
+ *
+ * junknes-bench [名前...] で指定したもの(省略時は全て)を実行する。各項目
+ * は REPEAT 回計測して最短時間を表示する
+ *
+ *   ppu-line : 固定したPPU状態で doLine() を繰り返す(BGのみ、BG+スプライト)
+ *   ppu-dot  : ppu-line と同じことをドット単位の描画(PpuRenderer::DOT)で行う
+ *              (出力は同じなので sum も ppu-line と一致する)
+ *   blip     : BlipBuffer に1フレーム分の差分を加えて読み出す(512, 32サンプルずつ)
+ *   mixer    : junknes_mixer_push() で1フレーム分をミックス、間引きして取
+ *              り出す(品質、出力レートごと)
+ */
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+#include "junknes.h"
+#include "ppu.hpp"
+#include "ppu-impl.hpp"
+#include "blip.hpp"
+
+using namespace std;
+
+namespace{
+    constexpr int REPEAT = 50;
+
+    // 再現性のため固定シードの xorshift
+    class Random{
+    public:
+        uint8_t next()
+        {
+            state_ ^= state_ << 13;
+            state_ ^= state_ >> 7;
+            state_ ^= state_ << 17;
+            return static_cast<uint8_t>(state_ >> 32);
+        }
+    private:
+        uint64_t state_ = UINT64_C(0x9E3779B97F4A7C15);
+    };
+
+    /**
+     * body() を REPEAT 回実行し、最短時間を count で割って表示する
+     * body() の戻り値は結果が捨てられないようにするためのチェックサム
+     */
+    void measure(const char* name, long count, const char* unit, const function<uint64_t()>& body)
+    {
+        uint64_t sum = body(); // ウォームアップ
+
+        double best = 1e30;
+        for(int i = 0; i < REPEAT; ++i){
+            auto start = chrono::steady_clock::now();
+            sum += body();
+            chrono::duration<double> dt = chrono::steady_clock::now() - start;
+            best = min(best, dt.count());
+        }
+
+        printf("%-24s %10.1f ns/%s  (%ld %ss, sum %016llx)\n",
+               name, best / count * 1e9, unit, count, unit,
+               static_cast<unsigned long long>(sum));
+    }
+
+
+    // PPUが外部から読む: CHR (パターンテーブル)とネームテーブル(垂直ミラー)
+    class BenchPpuDoor{
+    public:
+        BenchPpuDoor(const uint8_t* chr, uint8_t* vram) : chr_(chr), vram_(vram) {}
+
+        uint8_t readPpu(uint16_t addr)
+        {
+            if(addr < 0x2000) return chr_[addr];
+            return vram_[addr & 0x7FF];
+        }
+        void writePpu(uint16_t addr, uint8_t value)
+        {
+            if(addr >= 0x2000) vram_[addr & 0x7FF] = value;
+        }
+        void triggerNmi() {}
+
+    private:
+        const uint8_t* chr_;
+        uint8_t* vram_;
+    };
+
+    /**
+     * 乱数で埋めたCHR/VRAM/OAM/パレットで1フレーム分(240ライン)の
+     * startLine()/doLine()/endLine() を frames 回繰り返す
+     * mask は $2001 の値。スクロールはタイル境界に合わない位置にする
+     * R はビルド設定によらず指定した描画方式を使う
+     */
+    template<PpuRenderer R>
+    void benchPpuLine(const char* name, uint8_t mask)
+    {
+        constexpr int FRAMES = 500;
+
+        Random rnd;
+        array<uint8_t, 0x2000> chr;
+        array<uint8_t, 0x800> vram;
+        array<uint8_t, 0x100> oam;
+        for(auto& b : chr) b = rnd.next();
+        for(auto& b : vram) b = rnd.next();
+        for(auto& b : oam) b = rnd.next();
+
+        BasicPpu<BenchPpuDoor> ppu(make_shared<BenchPpuDoor>(chr.data(), vram.data()));
+        ppu.hardReset();
+        ppu.decodeChr(chr.data());
+        ppu.mapNametables({{ vram.data(), vram.data()+0x400, vram.data(), vram.data()+0x400 }});
+        for(int i = 0; i < 0x20; ++i)
+            ppu.writePltram(0x3F00 + i, rnd.next() & 0x3F);
+        ppu.oamDma(oam.data());
+        ppu.write2000(0x10);
+        ppu.write2001(mask);
+        ppu.write2005(13);
+        ppu.write2005(37);
+
+        vector<uint8_t> buf(256*240);
+        measure(name, 240L*FRAMES, "line", [&]{
+            uint64_t sum = 0;
+            for(int frame = 0; frame < FRAMES; ++frame){
+                ppu.reloadAddr();
+                for(int line = 0; line < 240; ++line){
+                    ppu.startLine();
+                    ppu.template doLine<R>(line, buf.data() + 256*line);
+                    ppu.endLine();
+                }
+                sum += buf[frame % buf.size()];
+            }
+            return sum;
+        });
+    }
+
+    void benchPpu()
+    {
+        benchPpuLine<PpuRenderer::LINE>("ppu-line (bg)", 0x0A);
+        benchPpuLine<PpuRenderer::LINE>("ppu-line (bg+spr)", 0x1E);
+    }
+
+    void benchPpuDot()
+    {
+        benchPpuLine<PpuRenderer::DOT>("ppu-dot (bg)", 0x0A);
+        benchPpuLine<PpuRenderer::DOT>("ppu-dot (bg+spr)", 0x1E);
+    }
+
+
+    /**
+     * 1フレーム(29781 CPUサイクル)に差分 DELTAS 個を加えて endFrame() し、
+     * 出力を chunk サンプルずつ全て読み出す
+     */
+    void benchBlipRead(const char* name, int chunk)
+    {
+        constexpr int FRAMES = 200;
+        constexpr int FRAME_CYCLE = 29781;
+        constexpr int DELTAS = 2000;
+
+        Random rnd;
+        vector<int> deltas(DELTAS);
+        for(int& d : deltas) d = int(rnd.next()) - 128;
+
+        BlipBuffer blip(1789772.7, 44100, 40000);
+        vector<int16_t> out(chunk);
+        measure(name, FRAMES, "frame", [&]{
+            uint64_t sum = 0;
+            for(int frame = 0; frame < FRAMES; ++frame){
+                for(int i = 0; i < DELTAS; ++i)
+                    blip.addDelta(i * (FRAME_CYCLE/DELTAS), deltas[i]);
+                blip.endFrame(FRAME_CYCLE);
+
+                int n;
+                while((n = blip.readSamples(out.data(), chunk)) > 0)
+                    sum += out[n-1];
+            }
+            return sum;
+        });
+    }
+
+    void benchBlip()
+    {
+        benchBlipRead("blip (read 512)", 512);
+        benchBlipRead("blip (read 32)", 32);
+    }
+
+
+    /**
+     * 1フレーム(29781 CPUサイクル)分のAPU出力を junknes_mixer_push() し、
+     * 同じ量を junknes_mixer_pull_sdl() で取り出す
+     * 入力はゲームの音楽程度に変化する合成波形(矩形波2つ、三角波、ノイズ、
+     * ゆっくり変わるDMC)
+     */
+    void benchMixerQuality(int freq, int quality)
+    {
+        constexpr int FRAMES = 60;
+        constexpr int FRAME_CYCLE = 29781;
+
+        Random rnd;
+        array<vector<uint8_t>, 5> ch;
+        for(auto& c : ch) c.resize(FRAME_CYCLE);
+        uint8_t noise = 0, dmc = 64;
+        for(int i = 0; i < FRAME_CYCLE; ++i){
+            ch[0][i] = (i/112) % 2 ? 8 : 0;
+            ch[1][i] = (i/150) % 4 ? 6 : 0;
+            ch[2][i] = (i/30) % 32 < 16 ? (i/30) % 16 : 15 - (i/30) % 16;
+            if(i % 200 == 0) noise = rnd.next() & 1 ? 5 : 0;
+            ch[3][i] = noise;
+            if(i % 432 == 0) dmc = min(127, max(0, dmc + (rnd.next() & 1 ? 2 : -2)));
+            ch[4][i] = dmc;
+        }
+        JunknesSound sound = {
+            { FRAME_CYCLE, ch[0].data() }, { FRAME_CYCLE, ch[1].data() }, { FRAME_CYCLE, ch[2].data() },
+            { FRAME_CYCLE, ch[3].data() }, { FRAME_CYCLE, ch[4].data() },
+        };
+
+        JunknesMixer* mixer = junknes_mixer_create(freq, 1024, 60);
+        junknes_mixer_set_quality(mixer, quality);
+        vector<uint8_t> stream(2 * (freq/60));
+
+        char name[64];
+        snprintf(name, sizeof(name), "mixer (q%d, %dHz)", quality, freq);
+        measure(name, FRAMES, "frame", [&]{
+            uint64_t sum = 0;
+            for(int frame = 0; frame < FRAMES; ++frame){
+                junknes_mixer_push(mixer, &sound);
+                junknes_mixer_pull_sdl(mixer, stream.data(), stream.size());
+                sum += stream[frame % stream.size()];
+            }
+            return sum;
+        });
+
+        junknes_mixer_destroy(mixer);
+    }
+
+    void benchMixer()
+    {
+        for(int freq : { 44100, 96000 })
+            for(int quality = 0; quality <= JUNKNES_MIXER_QUALITY_MAX; ++quality)
+                benchMixerQuality(freq, quality);
+    }
+
+
+    struct Bench{
+        const char* name;
+        void (*run)();
+    };
+    const Bench BENCHES[] = {
+        { "ppu-line", benchPpu },
+        { "ppu-dot",  benchPpuDot },
+        { "blip",     benchBlip },
+        { "mixer",    benchMixer },
+    };
+}
+
+int main(int argc, char** argv)
+{
+    for(const Bench& bench : BENCHES){
+        bool selected = argc < 2;
+        for(int i = 1; i < argc; ++i)
+            if(strcmp(argv[i], bench.name) == 0) selected = true;
+
+        if(selected) bench.run();
+    }
+
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cassert>
+
+#include "blip.hpp"
+
+using namespace std;
+
+namespace{
+    constexpr double PI = 3.14159265358979323846;
+
+    // ナイキスト周波数の90%で切る
+    constexpr double CUTOFF = 0.9;
+
+    double sinc(double x)
+    {
+        return x == 0.0 ? 1.0 : sin(PI*x) / (PI*x);
+    }
+
+    // Blackman窓。x は [-width/2, width/2]
+    double blackman(double x, int width)
+    {
+        return 0.42 + 0.5*cos(2*PI*x/width) + 0.08*cos(4*PI*x/width);
+    }
+}
+
+BlipBuffer::BlipBuffer(double clock_rate, int sample_rate, int max_frame_clock)
+    : factor_(static_cast<uint64_t>(sample_rate / clock_rate * 4294967296.0 + 0.5)),
+      keep_(sample_rate / 4)
+{
+    assert(0 < sample_rate && sample_rate < clock_rate);
+
+    // 各位相(サンプル間の時刻の端数)ごとのステップの差分波形
+    // 中心は WIDTH/2-1 + 端数 の位置。量子化誤差は中央のタップに寄せて、
+    // 合計を厳密に 1<<KERNEL_BITS にする(DCレベルがずれないように)
+    for(int p = 0; p < PHASES; ++p){
+        double frac = double(p) / PHASES;
+        array<double, WIDTH> taps;
+        double sum = 0;
+        for(int k = 0; k < WIDTH; ++k){
+            double x = k - (WIDTH/2-1) - frac;
+            taps[k] = sinc(CUTOFF*x) * blackman(x, WIDTH);
+            sum += taps[k];
+        }
+
+        int total = 0;
+        for(int k = 0; k < WIDTH; ++k){
+            kernel_[p][k] = lround(taps[k] / sum * (1<<KERNEL_BITS));
+            total += kernel_[p][k];
+        }
+        kernel_[p][WIDTH/2-1] += (1<<KERNEL_BITS) - total;
+    }
+
+    // 読み出した分は read_ を進めるだけにして、compact() で詰める回数が
+    // 少なくなるよう必要量(keep_ + 1フレーム + WIDTH)の倍程度確保する
+    frameSamples_ = static_cast<int>((uint64_t(max_frame_clock) * factor_) >> 32) + 1;
+    buf_.resize(2*(keep_ + frameSamples_) + WIDTH);
+
+    clear();
+}
+
+void BlipBuffer::clear()
+{
+    offset_     = 0;
+    read_       = 0;
+    avail_      = 0;
+    integrator_ = 0;
+    fill(buf_.begin(), buf_.end(), 0);
+}
+
+void BlipBuffer::addDelta(int time, int delta)
+{
+    uint64_t pos = offset_ + uint64_t(time) * factor_;
+    size_t idx = pos >> 32;
+    int phase = (pos >> (32-PHASE_BITS)) & (PHASES-1);
+    assert(idx + WIDTH <= buf_.size());
+
+    int32_t* out = buf_.data() + idx;
+    const auto& kernel = kernel_[phase];
+    for(int k = 0; k < WIDTH; ++k)
+        out[k] += delta * kernel[k];
+}
+
+void BlipBuffer::endFrame(int time)
+{
+    offset_ += uint64_t(time) * factor_;
+    avail_ = (offset_ >> 32) - read_;
+
+    // 読み出されずに溜まった分は古い方から捨てる(積分はしておく)
+    if(avail_ > keep_)
+        integrate(nullptr, avail_ - keep_);
+
+    compact();
+}
+
+int BlipBuffer::samplesAvail() const
+{
+    return avail_;
+}
+
+int BlipBuffer::readSamples(int16_t* out, int max)
+{
+    return integrate(out, min(max, avail_));
+}
+
+/**
+ * read_ から count サンプルを積分して out に書き出し、読み出し済みにす
+ * る。out == nullptr なら捨てる
+ */
+int BlipBuffer::integrate(int16_t* out, int count)
+{
+    if(count <= 0) return 0;
+
+    const int32_t* in = buf_.data() + read_;
+    int32_t sum = integrator_;
+    for(int i = 0; i < count; ++i){
+        sum += in[i];
+        int32_t s = sum >> KERNEL_BITS;
+        if(out) out[i] = static_cast<int16_t>(max(-0x8000, min(0x7FFF, s)));
+        sum -= sum >> BASS_SHIFT;
+    }
+    integrator_ = sum;
+
+    read_  += count;
+    avail_ -= count;
+
+    return count;
+}
+
+/**
+ * 次のフレームの書き込み位置が末尾に近ければ、生きている部分(未読のサ
+ * ンプルと、現フレーム末尾から WIDTH 分のカーネルの裾)だけを先頭に移す
+ * 差分はフレーム終了時刻より前にしか加えられないので、それより後ろは0
+ */
+void BlipBuffer::compact()
+{
+    size_t head = offset_ >> 32;
+    if(head + frameSamples_ + WIDTH <= buf_.size()) return;
+
+    size_t end = min(head + WIDTH, buf_.size());
+    copy(buf_.begin()+read_, buf_.begin()+end, buf_.begin());
+    fill(buf_.begin()+(end-read_), buf_.begin()+end, 0);
+    offset_ -= uint64_t(read_) << 32;
+    read_ = 0;
+}
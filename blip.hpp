@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * 帯域制限合成用のバッファ(blip buffer 方式)
+ *
+ * 入力は「クロック time で出力が delta だけ変化した」という差分のみ。
+ * 各差分を窓付きsinc関数で帯域制限したステップとして出力レートのバッフ
+ * ァに加算しておき、読み出し時に積分してサンプルにする
+ * 時刻はフレーム先頭からのクロック。endFrame() までに加えた差分がサン
+ * プルとして読み出せるようになる(差分を加える順序は任意)
+ */
+class BlipBuffer{
+public:
+    // max_frame_clock: 1フレームの最大クロック数
+    BlipBuffer(double clock_rate, int sample_rate, int max_frame_clock);
+
+    void clear();
+
+    void addDelta(int time, int delta);
+    void endFrame(int time);
+
+    int samplesAvail() const;
+    int readSamples(std::int16_t* out, int max);
+
+private:
+    int integrate(std::int16_t* out, int count);
+    void compact();
+
+    static constexpr int WIDTH      = 16; // カーネルのタップ数
+    static constexpr int PHASE_BITS = 5;  // サンプル間の時刻分解能
+    static constexpr int PHASES     = 1 << PHASE_BITS;
+    static constexpr int KERNEL_BITS = 15;
+    static constexpr int BASS_SHIFT = 9; // DC除去(高域通過)の強さ
+
+    std::uint64_t factor_; // 1クロックあたりのサンプル数(32bit固定小数点)
+    std::uint64_t offset_; // 現フレーム先頭の位置(同上、buf_ の先頭から)
+    std::size_t read_;     // 次に読み出すサンプルの位置(buf_ の添字)
+    int avail_;            // 読み出し可能なサンプル数
+    int keep_;             // 読み出されない場合に保持するサンプル数
+    int frameSamples_;     // 1フレームの最大サンプル数
+    std::int32_t integrator_;
+
+    std::array<std::array<std::int32_t, WIDTH>, PHASES> kernel_;
+    std::vector<std::int32_t> buf_;
+};
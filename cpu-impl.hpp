@@ -0,0 +1,1615 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <cstdint>
+#include <cassert>
+
+// BasicCpu の実装
+// インスタンス化する翻訳単位でのみインクルードする(cpu.cpp, nes.cpp)
+
+#include "junknes.h"
+#include "cpu.hpp"
+#include "util.hpp"
+
+using namespace std;
+
+namespace{
+    constexpr uint16_t VEC_NMI   = 0xFFFA;
+    constexpr uint16_t VEC_RESET = 0xFFFC;
+    constexpr uint16_t VEC_IRQ   = 0xFFFE;
+
+    constexpr int OP_ARGLEN[0x100] = {
+        /*0x00*/ 1,1,0,1, 1,1,1,1, 0,1,0,1, 2,2,2,2,
+        /*0x10*/ 1,1,0,1, 1,1,1,1, 0,2,0,2, 2,2,2,2,
+        /*0x20*/ 2,1,0,1, 1,1,1,1, 0,1,0,1, 2,2,2,2,
+        /*0x30*/ 1,1,0,1, 1,1,1,1, 0,2,0,2, 2,2,2,2,
+        /*0x40*/ 0,1,0,1, 1,1,1,1, 0,1,0,1, 2,2,2,2,
+        /*0x50*/ 1,1,0,1, 1,1,1,1, 0,2,0,2, 2,2,2,2,
+        /*0x60*/ 0,1,0,1, 1,1,1,1, 0,1,0,1, 2,2,2,2,
+        /*0x70*/ 1,1,0,1, 1,1,1,1, 0,2,0,2, 2,2,2,2,
+        /*0x80*/ 1,1,1,1, 1,1,1,1, 0,1,0,1, 2,2,2,2,
+        /*0x90*/ 1,1,0,1, 1,1,1,1, 0,2,0,2, 2,2,2,2,
+        /*0xA0*/ 1,1,1,1, 1,1,1,1, 0,1,0,1, 2,2,2,2,
+        /*0xB0*/ 1,1,0,1, 1,1,1,1, 0,2,0,2, 2,2,2,2,
+        /*0xC0*/ 1,1,1,1, 1,1,1,1, 0,1,0,1, 2,2,2,2,
+        /*0xD0*/ 1,1,0,1, 1,1,1,1, 0,2,0,2, 2,2,2,2,
+        /*0xE0*/ 1,1,1,1, 1,1,1,1, 0,1,0,1, 2,2,2,2,
+        /*0xF0*/ 1,1,0,1, 1,1,1,1, 0,2,0,2, 2,2,2,2
+    };
+
+    // copied from FCEUX
+    constexpr int OP_CYCLE[0x100] = {
+        /*0x00*/ 7,6,2,8, 3,3,5,5, 3,2,2,2, 4,4,6,6,
+        /*0x10*/ 2,5,2,8, 4,4,6,6, 2,4,2,7, 4,4,7,7,
+        /*0x20*/ 6,6,2,8, 3,3,5,5, 4,2,2,2, 4,4,6,6,
+        /*0x30*/ 2,5,2,8, 4,4,6,6, 2,4,2,7, 4,4,7,7,
+        /*0x40*/ 6,6,2,8, 3,3,5,5, 3,2,2,2, 3,4,6,6,
+        /*0x50*/ 2,5,2,8, 4,4,6,6, 2,4,2,7, 4,4,7,7,
+        /*0x60*/ 6,6,2,8, 3,3,5,5, 4,2,2,2, 5,4,6,6,
+        /*0x70*/ 2,5,2,8, 4,4,6,6, 2,4,2,7, 4,4,7,7,
+        /*0x80*/ 2,6,2,6, 3,3,3,3, 2,2,2,2, 4,4,4,4,
+        /*0x90*/ 2,6,2,6, 4,4,4,4, 2,5,2,5, 5,5,5,5,
+        /*0xA0*/ 2,6,2,6, 3,3,3,3, 2,2,2,2, 4,4,4,4,
+        /*0xB0*/ 2,5,2,5, 4,4,4,4, 2,4,2,4, 4,4,4,4,
+        /*0xC0*/ 2,6,2,8, 3,3,5,5, 2,2,2,2, 4,4,6,6,
+        /*0xD0*/ 2,5,2,8, 4,4,6,6, 2,4,2,7, 4,4,7,7,
+        /*0xE0*/ 2,6,3,8, 3,3,5,5, 2,2,2,2, 4,4,6,6, // 0xE2 は 2 だと思うがFCEUXに合わせた
+        /*0xF0*/ 2,5,2,8, 4,4,6,6, 2,4,2,7, 4,4,7,7
+    };
+}
+
+
+
+template<typename DoorT>
+BasicCpu<DoorT>::BasicCpu(const shared_ptr<Door>& door)
+    : door_(door), beforeExecHook_(nullptr), execLoop_(&BasicCpu::execLoop<false>),
+      apuPending_(0), apuDeadline_(0), apuTicks_(0), predecoded_(false)
+{
+    
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::predecode(const uint8_t* rom)
+{
+    for(int i = 0; i < 0x8000; ++i){
+        Decoded& d = romOps_[i];
+        d.opcode = rom[i];
+
+        int arglen = OP_ARGLEN[d.opcode];
+        if(i + arglen >= 0x8000){
+            d.len = 0;
+            d.arg = 0;
+            continue;
+        }
+
+        d.len = 1 + arglen;
+        switch(arglen){
+        case 0: d.arg = 0; break;
+        case 1: d.arg = rom[i+1]; break;
+        case 2: d.arg = rom[i+1] | (rom[i+2]<<8); break;
+        default: /* NOT REACHED */ assert(false); break;
+        }
+    }
+
+    predecoded_ = true;
+}
+
+template<typename DoorT>
+JunknesCpuState BasicCpu<DoorT>::state() const
+{
+    JunknesCpuState st;
+
+    st.PC = PC_;
+    st.A  = A_;
+    st.X  = X_;
+    st.Y  = Y_;
+    st.S  = S_;
+
+    st.P.C = flagC_;
+    st.P.Z = !zRes_;
+    st.P.I = flagI_;
+    st.P.D = flagD_;
+    st.P.V = flagV_;
+    st.P.N = nRes_ >> 7;
+
+    return st;
+}
+
+/**
+ * http://wiki.nesdev.com/w/index.php/CPU_power_up_state
+ *
+ * FCEUXはRESET割り込みの処理を遅らせてるけど…
+ */
+template<typename DoorT>
+void BasicCpu<DoorT>::hardReset()
+{
+    restCycle_ = 0;
+    opRestCycle_ = 0;
+
+    nmi_ = false;
+    irq_ = false;
+
+    PC_ = read16(VEC_RESET);
+
+    A_ = 0;
+    X_ = 0;
+    Y_ = 0;
+
+    S_ = 0xFD;
+
+    unpackP(0x34); // I, b4, b5
+
+    jammed_ = false;
+
+    apuRestCycle_ = 0;
+    apuPending_   = 0;
+    apuDeadline_  = 0;
+
+    idle_.valid = false;
+}
+
+/**
+ * http://wiki.nesdev.com/w/index.php/CPU_power_up_state
+ *
+ * FCEUXはRESET割り込みフラグを立てるだけなので結構違いが出るかも
+ */
+template<typename DoorT>
+void BasicCpu<DoorT>::softReset()
+{
+    // 溜まっているAPUサイクルはリセット前の状態で処理しておく
+    syncApu();
+
+    //restCycle_ = 0; // サイクル数は触らない方がいい?
+
+    nmi_ = false;
+    irq_ = false;
+
+    PC_ = read16(VEC_RESET);
+
+    S_ -= 3;
+
+    flagI_ = 1;
+
+    jammed_ = false;
+
+    //apuRestCycle_ = 0;
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::triggerNmi()
+{
+    nmi_ = true;
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::triggerIrq()
+{
+    irq_ = true;
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::oamDmaDelay()
+{
+    delay(512); // FCEUXと同じ。正しくは513or514?
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::dmcDmaDelay(int cycle)
+{
+    delay(cycle);
+}
+
+/**
+ * 遅延しているAPUサイクルを全て処理する
+ * APUレジスタへのアクセス前とフレーム終了時に呼ぶこと
+ * アクセスによってイベント時刻が変わりうるので、次の命令で再計算させる
+ */
+template<typename DoorT>
+void BasicCpu<DoorT>::syncApu()
+{
+    if(apuPending_){
+        door_->tickApu(apuPending_);
+        apuPending_ = 0;
+        ++apuTicks_;
+    }
+    apuDeadline_ = 0;
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::beforeExec(JunknesCpuHook hook, void* userdata)
+{
+    beforeExecHook_ = hook;
+    beforeExecData_ = userdata;
+
+    // フックの有無で実行ループを切り替える(フックなしなら一切コストを払わない)
+    execLoop_ = hook ? &BasicCpu::execLoop<true> : &BasicCpu::execLoop<false>;
+}
+
+/**
+ * 割り込み処理と命令のフェッチを行う
+ * 残りサイクルが足りなければ何もせず false を返す
+ *
+ * Traced == false ならフック呼び出しとそのための状態取得を省く
+ */
+template<typename DoorT>
+template<bool Traced>
+bool BasicCpu<DoorT>::beginOp(uint8_t& opcode, uint16_t& arg)
+{
+    if(restCycle_ < 3) return false;
+    opRestCycle_ = restCycle_;
+
+    if(nmi_ && !jammed_){
+        doNmi();
+        nmi_ = false;
+    }
+    else if(irq_ && !jammed_){
+        if(!flagI_) doIrq();
+        irq_ = false;
+    }
+
+    if(Traced){
+        JunknesCpuState st = state();
+        fetchOp(opcode, arg);
+        beforeExecHook_(&st, opcode, arg, beforeExecData_);
+    }
+    else{
+        fetchOp(opcode, arg);
+    }
+
+    return true;
+}
+
+/**
+ * 命令のサイクル消費とAPU処理
+ *
+ * APUは次のイベント(フレームカウンタのstep、DMCのDMA)が起こる命令
+ * までまとめて遅延処理する。イベントが起こる命令ではそれまでの分と
+ * その命令の分を別々に渡すので、1命令ごとに処理したのと同じタイミン
+ * グになる(FCEUXと同じ…はず)
+ */
+template<typename DoorT>
+void BasicCpu<DoorT>::tickOp(int cycle)
+{
+    delay(cycle);
+
+    int tmp = apuRestCycle_;
+    apuRestCycle_ = 0;
+    if(apuPending_ + tmp < apuDeadline_){
+        apuPending_ += tmp;
+    }
+    else{
+        if(apuPending_) door_->tickApu(apuPending_);
+        apuPending_ = 0;
+        door_->tickApu(tmp);
+        apuDeadline_ = door_->apuNextEvent();
+        ++apuTicks_;
+    }
+}
+
+// switch版の命令の前処理
+template<typename DoorT>
+template<bool Traced>
+bool BasicCpu<DoorT>::stepOp(uint8_t& opcode, uint16_t& arg)
+{
+    if(!beginOp<Traced>(opcode, arg)) return false;
+
+    tickOp(OP_CYCLE[opcode]);
+
+    return true;
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::exec(int cycle)
+{
+    restCycle_ += cycle;
+
+    // exec() の外ではPPUなどの状態が変わりうる
+    idle_.valid = false;
+
+    (this->*execLoop_)();
+}
+
+template<typename DoorT>
+int BasicCpu<DoorT>::restCycleAtOp() const
+{
+    return opRestCycle_;
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::cutSlice(int cycle)
+{
+    restCycle_   -= cycle;
+    opRestCycle_ -= cycle;
+}
+
+template<typename DoorT>
+template<bool Traced>
+void BasicCpu<DoorT>::execLoop()
+{
+    uint8_t opcode;
+    uint16_t arg;
+
+#ifdef JUNKNES_CPU_THREADED
+#   ifndef __GNUC__
+#       error "JUNKNES_CPU_THREADED requires GCC/Clang (computed goto)"
+#   endif
+    // direct-threaded dispatch: 各命令の末尾で次の命令を処理し、ハンド
+    // ラへ直接ジャンプする(GCC拡張の computed goto を使用)
+    static const void* const OP_LABELS[0x100] = {
+        &&op_0x00, &&op_0x01, &&op_0x02, &&op_0x03, &&op_0x04, &&op_0x05, &&op_0x06, &&op_0x07, &&op_0x08, &&op_0x09, &&op_0x0A, &&op_0x0B, &&op_0x0C, &&op_0x0D, &&op_0x0E, &&op_0x0F,
+        &&op_0x10, &&op_0x11, &&op_0x12, &&op_0x13, &&op_0x14, &&op_0x15, &&op_0x16, &&op_0x17, &&op_0x18, &&op_0x19, &&op_0x1A, &&op_0x1B, &&op_0x1C, &&op_0x1D, &&op_0x1E, &&op_0x1F,
+        &&op_0x20, &&op_0x21, &&op_0x22, &&op_0x23, &&op_0x24, &&op_0x25, &&op_0x26, &&op_0x27, &&op_0x28, &&op_0x29, &&op_0x2A, &&op_0x2B, &&op_0x2C, &&op_0x2D, &&op_0x2E, &&op_0x2F,
+        &&op_0x30, &&op_0x31, &&op_0x32, &&op_0x33, &&op_0x34, &&op_0x35, &&op_0x36, &&op_0x37, &&op_0x38, &&op_0x39, &&op_0x3A, &&op_0x3B, &&op_0x3C, &&op_0x3D, &&op_0x3E, &&op_0x3F,
+        &&op_0x40, &&op_0x41, &&op_0x42, &&op_0x43, &&op_0x44, &&op_0x45, &&op_0x46, &&op_0x47, &&op_0x48, &&op_0x49, &&op_0x4A, &&op_0x4B, &&op_0x4C, &&op_0x4D, &&op_0x4E, &&op_0x4F,
+        &&op_0x50, &&op_0x51, &&op_0x52, &&op_0x53, &&op_0x54, &&op_0x55, &&op_0x56, &&op_0x57, &&op_0x58, &&op_0x59, &&op_0x5A, &&op_0x5B, &&op_0x5C, &&op_0x5D, &&op_0x5E, &&op_0x5F,
+        &&op_0x60, &&op_0x61, &&op_0x62, &&op_0x63, &&op_0x64, &&op_0x65, &&op_0x66, &&op_0x67, &&op_0x68, &&op_0x69, &&op_0x6A, &&op_0x6B, &&op_0x6C, &&op_0x6D, &&op_0x6E, &&op_0x6F,
+        &&op_0x70, &&op_0x71, &&op_0x72, &&op_0x73, &&op_0x74, &&op_0x75, &&op_0x76, &&op_0x77, &&op_0x78, &&op_0x79, &&op_0x7A, &&op_0x7B, &&op_0x7C, &&op_0x7D, &&op_0x7E, &&op_0x7F,
+        &&op_0x80, &&op_0x81, &&op_0x82, &&op_0x83, &&op_0x84, &&op_0x85, &&op_0x86, &&op_0x87, &&op_0x88, &&op_0x89, &&op_0x8A, &&op_0x8B, &&op_0x8C, &&op_0x8D, &&op_0x8E, &&op_0x8F,
+        &&op_0x90, &&op_0x91, &&op_0x92, &&op_0x93, &&op_0x94, &&op_0x95, &&op_0x96, &&op_0x97, &&op_0x98, &&op_0x99, &&op_0x9A, &&op_0x9B, &&op_0x9C, &&op_0x9D, &&op_0x9E, &&op_0x9F,
+        &&op_0xA0, &&op_0xA1, &&op_0xA2, &&op_0xA3, &&op_0xA4, &&op_0xA5, &&op_0xA6, &&op_0xA7, &&op_0xA8, &&op_0xA9, &&op_0xAA, &&op_0xAB, &&op_0xAC, &&op_0xAD, &&op_0xAE, &&op_0xAF,
+        &&op_0xB0, &&op_0xB1, &&op_0xB2, &&op_0xB3, &&op_0xB4, &&op_0xB5, &&op_0xB6, &&op_0xB7, &&op_0xB8, &&op_0xB9, &&op_0xBA, &&op_0xBB, &&op_0xBC, &&op_0xBD, &&op_0xBE, &&op_0xBF,
+        &&op_0xC0, &&op_0xC1, &&op_0xC2, &&op_0xC3, &&op_0xC4, &&op_0xC5, &&op_0xC6, &&op_0xC7, &&op_0xC8, &&op_0xC9, &&op_0xCA, &&op_0xCB, &&op_0xCC, &&op_0xCD, &&op_0xCE, &&op_0xCF,
+        &&op_0xD0, &&op_0xD1, &&op_0xD2, &&op_0xD3, &&op_0xD4, &&op_0xD5, &&op_0xD6, &&op_0xD7, &&op_0xD8, &&op_0xD9, &&op_0xDA, &&op_0xDB, &&op_0xDC, &&op_0xDD, &&op_0xDE, &&op_0xDF,
+        &&op_0xE0, &&op_0xE1, &&op_0xE2, &&op_0xE3, &&op_0xE4, &&op_0xE5, &&op_0xE6, &&op_0xE7, &&op_0xE8, &&op_0xE9, &&op_0xEA, &&op_0xEB, &&op_0xEC, &&op_0xED, &&op_0xEE, &&op_0xEF,
+        &&op_0xF0, &&op_0xF1, &&op_0xF2, &&op_0xF3, &&op_0xF4, &&op_0xF5, &&op_0xF6, &&op_0xF7, &&op_0xF8, &&op_0xF9, &&op_0xFA, &&op_0xFB, &&op_0xFC, &&op_0xFD, &&op_0xFE, &&op_0xFF
+    };
+    // 前処理は switch版と同じ stepOp() で、dispatchだけが異なる。ROM上の
+    // 命令はオペコードとオペランドを romOps_ からまとめて取る
+#   define OP(code) op_##code:
+#   define NEXT     do{ if(!stepOp<Traced>(opcode, arg)) return; goto *OP_LABELS[opcode]; }while(0)
+
+    NEXT;
+    {
+#else
+#   define OP(code) case code:
+#   define NEXT     continue
+
+    while(stepOp<Traced>(opcode, arg)){
+        switch(opcode){
+#endif
+        //------------------------------------------------------------
+        // official
+        //------------------------------------------------------------
+        OP(0xA9) LDA(arg);         NEXT;
+        OP(0xA5) LDA(LD_ZP(arg));  NEXT;
+        OP(0xB5) LDA(LD_ZPX(arg)); NEXT;
+        OP(0xAD) LDA(LD_AB(arg));  NEXT;
+        OP(0xBD) LDA(LD_ABX(arg)); NEXT;
+        OP(0xB9) LDA(LD_ABY(arg)); NEXT;
+        OP(0xA1) LDA(LD_IX(arg));  NEXT;
+        OP(0xB1) LDA(LD_IY(arg));  NEXT;
+
+        OP(0xA2) LDX(arg);         NEXT;
+        OP(0xA6) LDX(LD_ZP(arg));  NEXT;
+        OP(0xB6) LDX(LD_ZPY(arg)); NEXT;
+        OP(0xAE) LDX(LD_AB(arg));  NEXT;
+        OP(0xBE) LDX(LD_ABY(arg)); NEXT;
+
+        OP(0xA0) LDY(arg);         NEXT;
+        OP(0xA4) LDY(LD_ZP(arg));  NEXT;
+        OP(0xB4) LDY(LD_ZPX(arg)); NEXT;
+        OP(0xAC) LDY(LD_AB(arg));  NEXT;
+        OP(0xBC) LDY(LD_ABX(arg)); NEXT;
+
+        // STA
+        OP(0x85) ST_ZP(arg, A_);  NEXT;
+        OP(0x95) ST_ZPX(arg, A_); NEXT;
+        OP(0x8D) ST_AB(arg, A_);  NEXT;
+        OP(0x9D) ST_ABX(arg, A_); NEXT;
+        OP(0x99) ST_ABY(arg, A_); NEXT;
+        OP(0x81) ST_IX(arg, A_);  NEXT;
+        OP(0x91) ST_IY(arg, A_);  NEXT;
+
+        // STX
+        OP(0x86) ST_ZP(arg, X_);  NEXT;
+        OP(0x96) ST_ZPY(arg, X_); NEXT;
+        OP(0x8E) ST_AB(arg, X_);  NEXT;
+
+        // STY
+        OP(0x84) ST_ZP(arg, Y_);  NEXT;
+        OP(0x94) ST_ZPX(arg, Y_); NEXT;
+        OP(0x8C) ST_AB(arg, Y_);  NEXT;
+
+        OP(0xAA) /* TAX */ ZN_UPDATE(X_ = A_); NEXT;
+        OP(0x8A) /* TXA */ ZN_UPDATE(A_ = X_); NEXT;
+        OP(0xA8) /* TAY */ ZN_UPDATE(Y_ = A_); NEXT;
+        OP(0x98) /* TYA */ ZN_UPDATE(A_ = Y_); NEXT;
+        OP(0xBA) /* TSX */ ZN_UPDATE(X_ = S_); NEXT;
+        OP(0x9A) /* TXS */ S_ = X_;            NEXT;
+
+        OP(0x69) ADC(arg);         NEXT;
+        OP(0x65) ADC(LD_ZP(arg));  NEXT;
+        OP(0x75) ADC(LD_ZPX(arg)); NEXT;
+        OP(0x6D) ADC(LD_AB(arg));  NEXT;
+        OP(0x7D) ADC(LD_ABX(arg)); NEXT;
+        OP(0x79) ADC(LD_ABY(arg)); NEXT;
+        OP(0x61) ADC(LD_IX(arg));  NEXT;
+        OP(0x71) ADC(LD_IY(arg));  NEXT;
+
+        OP(0xE9) SBC(arg);         NEXT;
+        OP(0xE5) SBC(LD_ZP(arg));  NEXT;
+        OP(0xF5) SBC(LD_ZPX(arg)); NEXT;
+        OP(0xED) SBC(LD_AB(arg));  NEXT;
+        OP(0xFD) SBC(LD_ABX(arg)); NEXT;
+        OP(0xF9) SBC(LD_ABY(arg)); NEXT;
+        OP(0xE1) SBC(LD_IX(arg));  NEXT;
+        OP(0xF1) SBC(LD_IY(arg));  NEXT;
+
+        OP(0x09) ORA(arg);         NEXT;
+        OP(0x05) ORA(LD_ZP(arg));  NEXT;
+        OP(0x15) ORA(LD_ZPX(arg)); NEXT;
+        OP(0x0D) ORA(LD_AB(arg));  NEXT;
+        OP(0x1D) ORA(LD_ABX(arg)); NEXT;
+        OP(0x19) ORA(LD_ABY(arg)); NEXT;
+        OP(0x01) ORA(LD_IX(arg));  NEXT;
+        OP(0x11) ORA(LD_IY(arg));  NEXT;
+
+        OP(0x29) AND(arg);         NEXT;
+        OP(0x25) AND(LD_ZP(arg));  NEXT;
+        OP(0x35) AND(LD_ZPX(arg)); NEXT;
+        OP(0x2D) AND(LD_AB(arg));  NEXT;
+        OP(0x3D) AND(LD_ABX(arg)); NEXT;
+        OP(0x39) AND(LD_ABY(arg)); NEXT;
+        OP(0x21) AND(LD_IX(arg));  NEXT;
+        OP(0x31) AND(LD_IY(arg));  NEXT;
+
+        OP(0x49) EOR(arg);         NEXT;
+        OP(0x45) EOR(LD_ZP(arg));  NEXT;
+        OP(0x55) EOR(LD_ZPX(arg)); NEXT;
+        OP(0x4D) EOR(LD_AB(arg));  NEXT;
+        OP(0x5D) EOR(LD_ABX(arg)); NEXT;
+        OP(0x59) EOR(LD_ABY(arg)); NEXT;
+        OP(0x41) EOR(LD_IX(arg));  NEXT;
+        OP(0x51) EOR(LD_IY(arg));  NEXT;
+
+        OP(0x0A) ASL();             NEXT;
+        OP(0x06) ASL(RMW_ZP(arg));  NEXT;
+        OP(0x16) ASL(RMW_ZPX(arg)); NEXT;
+        OP(0x0E) ASL(RMW_AB(arg));  NEXT;
+        OP(0x1E) ASL(RMW_ABX(arg)); NEXT;
+
+        OP(0x4A) LSR();             NEXT;
+        OP(0x46) LSR(RMW_ZP(arg));  NEXT;
+        OP(0x56) LSR(RMW_ZPX(arg)); NEXT;
+        OP(0x4E) LSR(RMW_AB(arg));  NEXT;
+        OP(0x5E) LSR(RMW_ABX(arg)); NEXT;
+
+        OP(0x2A) ROL();             NEXT;
+        OP(0x26) ROL(RMW_ZP(arg));  NEXT;
+        OP(0x36) ROL(RMW_ZPX(arg)); NEXT;
+        OP(0x2E) ROL(RMW_AB(arg));  NEXT;
+        OP(0x3E) ROL(RMW_ABX(arg)); NEXT;
+
+        OP(0x6A) ROR();             NEXT;
+        OP(0x66) ROR(RMW_ZP(arg));  NEXT;
+        OP(0x76) ROR(RMW_ZPX(arg)); NEXT;
+        OP(0x6E) ROR(RMW_AB(arg));  NEXT;
+        OP(0x7E) ROR(RMW_ABX(arg)); NEXT;
+
+        OP(0x24) BIT(LD_ZP(arg)); NEXT;
+        OP(0x2C) BIT(LD_AB(arg)); NEXT;
+
+        OP(0xE6) INC(RMW_ZP(arg));     NEXT;
+        OP(0xF6) INC(RMW_ZPX(arg));    NEXT;
+        OP(0xEE) INC(RMW_AB(arg));     NEXT;
+        OP(0xFE) INC(RMW_ABX(arg));    NEXT;
+        OP(0xE8) /* INX */ INC_DO(X_); NEXT;
+        OP(0xC8) /* INY */ INC_DO(Y_); NEXT;
+
+        OP(0xC6) DEC(RMW_ZP(arg));     NEXT;
+        OP(0xD6) DEC(RMW_ZPX(arg));    NEXT;
+        OP(0xCE) DEC(RMW_AB(arg));     NEXT;
+        OP(0xDE) DEC(RMW_ABX(arg));    NEXT;
+        OP(0xCA) /* DEX */ DEC_DO(X_); NEXT;
+        OP(0x88) /* DEY */ DEC_DO(Y_); NEXT;
+
+        OP(0xC9) CMP(arg);         NEXT;
+        OP(0xC5) CMP(LD_ZP(arg));  NEXT;
+        OP(0xD5) CMP(LD_ZPX(arg)); NEXT;
+        OP(0xCD) CMP(LD_AB(arg));  NEXT;
+        OP(0xDD) CMP(LD_ABX(arg)); NEXT;
+        OP(0xD9) CMP(LD_ABY(arg)); NEXT;
+        OP(0xC1) CMP(LD_IX(arg));  NEXT;
+        OP(0xD1) CMP(LD_IY(arg));  NEXT;
+
+        OP(0xE0) CPX(arg);        NEXT;
+        OP(0xE4) CPX(LD_ZP(arg)); NEXT;
+        OP(0xEC) CPX(LD_AB(arg)); NEXT;
+
+        OP(0xC0) CPY(arg);        NEXT;
+        OP(0xC4) CPY(LD_ZP(arg)); NEXT;
+        OP(0xCC) CPY(LD_AB(arg)); NEXT;
+
+        OP(0xB0) /* BCS */ BRANCH(arg, flagC_);  NEXT;
+        OP(0x90) /* BCC */ BRANCH(arg, !flagC_); NEXT;
+        OP(0xF0) /* BEQ */ BRANCH(arg, !zRes_); NEXT;
+        OP(0xD0) /* BNE */ BRANCH(arg, zRes_);  NEXT;
+        OP(0x70) /* BVS */ BRANCH(arg, flagV_);  NEXT;
+        OP(0x50) /* BVC */ BRANCH(arg, !flagV_); NEXT;
+        OP(0x30) /* BMI */ BRANCH(arg, nRes_ & 0x80);    NEXT;
+        OP(0x10) /* BPL */ BRANCH(arg, !(nRes_ & 0x80)); NEXT;
+
+        OP(0x38) /* SEC */ flagC_ = 1; NEXT;
+        OP(0x18) /* CLC */ flagC_ = 0; NEXT;
+        OP(0x78) /* SEI */ flagI_ = 1; NEXT;
+        OP(0x58) /* CLI */ flagI_ = 0; NEXT;
+        OP(0xF8) /* SED */ flagD_ = 1; NEXT;
+        OP(0xD8) /* CLD */ flagD_ = 0; NEXT;
+        OP(0xB8) /* CLV */ flagV_ = 0; NEXT;
+
+        OP(0x4C) JMP_AB(arg);  NEXT;
+        OP(0x6C) JMP_IND(arg); NEXT;
+
+        OP(0x20) JSR(arg); NEXT;
+        OP(0x60) RTS();    NEXT;
+        OP(0x40) RTI();    NEXT;
+
+        OP(0x00) BRK(); NEXT;
+
+        OP(0x48) /* PHA */ push8(A_);              NEXT;
+        OP(0x08) /* PHP */ PUSH_P(/* b4= */ true); NEXT;
+
+        OP(0x68) /* PLA */ ZN_UPDATE(A_ = pop8()); NEXT;
+        OP(0x28) /* PLP */ POP_P();                NEXT;
+
+        OP(0xEA) NEXT; // NOP
+
+        //------------------------------------------------------------
+        // unofficial
+        //------------------------------------------------------------
+        OP(0x02)
+        OP(0x12)
+        OP(0x22)
+        OP(0x32)
+        OP(0x42)
+        OP(0x52)
+        OP(0x62)
+        OP(0x72)
+        OP(0x92)
+        OP(0xB2)
+        OP(0xD2)
+        OP(0xF2) KIL(); NEXT;
+
+        // NOP
+        OP(0x1A)
+        OP(0x3A)
+        OP(0x5A)
+        OP(0x7A)
+        OP(0xDA)
+        OP(0xFA) NEXT;
+
+        // DOP (double NOP)
+        // im
+        OP(0x80)
+        OP(0x82)
+        OP(0x89)
+        OP(0xC2)
+        OP(0xE2) NEXT;
+        // zp (どうせ副作用は起こらないので read() は省略。FCEUXと同じ)
+        OP(0x04)
+        OP(0x44)
+        OP(0x64) NEXT;
+        // zpx (どうせ副作用はry)
+        OP(0x14)
+        OP(0x34)
+        OP(0x54)
+        OP(0x74)
+        OP(0xD4)
+        OP(0xF4) NEXT;
+
+        // TOP (triple NOP)
+        // ab (副作用が起こりうるのでオペランドを読む。FCEUXと同じ)
+        OP(0x0C) LD_AB(arg); NEXT;
+        // abx (副作用が起こりうるのでry)
+        OP(0x1C)
+        OP(0x3C)
+        OP(0x5C)
+        OP(0x7C)
+        OP(0xDC)
+        OP(0xFC) LD_ABX(arg); NEXT;
+
+        OP(0xEB) SBC(arg); NEXT;
+
+        OP(0x4B) ALR(arg); NEXT;
+
+        OP(0x0B)
+        OP(0x2B) ANC(arg); NEXT;
+
+        OP(0x6B) ARR(arg); NEXT;
+
+        OP(0xCB) AXS(arg); NEXT;
+
+        OP(0xA7) LAX(LD_ZP(arg));  NEXT;
+        OP(0xB7) LAX(LD_ZPY(arg)); NEXT;
+        OP(0xAF) LAX(LD_AB(arg));  NEXT;
+        OP(0xBF) LAX(LD_ABY(arg)); NEXT;
+        OP(0xA3) LAX(LD_IX(arg));  NEXT;
+        OP(0xB3) LAX(LD_IY(arg));  NEXT;
+
+        // SAX
+        OP(0x87) ST_ZP (arg, A_ & X_); NEXT;
+        OP(0x97) ST_ZPY(arg, A_ & X_); NEXT;
+        OP(0x8F) ST_AB (arg, A_ & X_); NEXT;
+        OP(0x83) ST_IX (arg, A_ & X_); NEXT;
+
+        OP(0xC7) DCP(RMW_ZP(arg));  NEXT;
+        OP(0xD7) DCP(RMW_ZPX(arg)); NEXT;
+        OP(0xCF) DCP(RMW_AB(arg));  NEXT;
+        OP(0xDF) DCP(RMW_ABX(arg)); NEXT;
+        OP(0xDB) DCP(RMW_ABY(arg)); NEXT;
+        OP(0xC3) DCP(RMW_IX(arg));  NEXT;
+        OP(0xD3) DCP(RMW_IY(arg));  NEXT;
+
+        OP(0xE7) ISC(RMW_ZP(arg));  NEXT;
+        OP(0xF7) ISC(RMW_ZPX(arg)); NEXT;
+        OP(0xEF) ISC(RMW_AB(arg));  NEXT;
+        OP(0xFF) ISC(RMW_ABX(arg)); NEXT;
+        OP(0xFB) ISC(RMW_ABY(arg)); NEXT;
+        OP(0xE3) ISC(RMW_IX(arg));  NEXT;
+        OP(0xF3) ISC(RMW_IY(arg));  NEXT;
+
+        OP(0x27) RLA(RMW_ZP(arg));  NEXT;
+        OP(0x37) RLA(RMW_ZPX(arg)); NEXT;
+        OP(0x2F) RLA(RMW_AB(arg));  NEXT;
+        OP(0x3F) RLA(RMW_ABX(arg)); NEXT;
+        OP(0x3B) RLA(RMW_ABY(arg)); NEXT;
+        OP(0x23) RLA(RMW_IX(arg));  NEXT;
+        OP(0x33) RLA(RMW_IY(arg));  NEXT;
+
+        OP(0x67) RRA(RMW_ZP(arg));  NEXT;
+        OP(0x77) RRA(RMW_ZPX(arg)); NEXT;
+        OP(0x6F) RRA(RMW_AB(arg));  NEXT;
+        OP(0x7F) RRA(RMW_ABX(arg)); NEXT;
+        OP(0x7B) RRA(RMW_ABY(arg)); NEXT;
+        OP(0x63) RRA(RMW_IX(arg));  NEXT;
+        OP(0x73) RRA(RMW_IY(arg));  NEXT;
+
+        OP(0x07) SLO(RMW_ZP(arg));  NEXT;
+        OP(0x17) SLO(RMW_ZPX(arg)); NEXT;
+        OP(0x0F) SLO(RMW_AB(arg));  NEXT;
+        OP(0x1F) SLO(RMW_ABX(arg)); NEXT;
+        OP(0x1B) SLO(RMW_ABY(arg)); NEXT;
+        OP(0x03) SLO(RMW_IX(arg));  NEXT;
+        OP(0x13) SLO(RMW_IY(arg));  NEXT;
+
+        OP(0x47) SRE(RMW_ZP(arg));  NEXT;
+        OP(0x57) SRE(RMW_ZPX(arg)); NEXT;
+        OP(0x4F) SRE(RMW_AB(arg));  NEXT;
+        OP(0x5F) SRE(RMW_ABX(arg)); NEXT;
+        OP(0x5B) SRE(RMW_ABY(arg)); NEXT;
+        OP(0x43) SRE(RMW_IX(arg));  NEXT;
+        OP(0x53) SRE(RMW_IY(arg));  NEXT;
+
+        OP(0xBB) LAS(arg); NEXT;
+
+        OP(0x9F) AHX_ABY(arg); NEXT;
+        OP(0x93) AHX_IY(arg);  NEXT;
+
+        OP(0x9B) TAS(arg); NEXT;
+
+        OP(0x9E) SHX(arg); NEXT;
+
+        OP(0x9C) SHY(arg); NEXT;
+
+        OP(0xAB) LAX_IM(arg); NEXT;
+
+        OP(0x8B) XAA(arg); NEXT;
+#ifdef JUNKNES_CPU_THREADED
+    }
+#else
+        }
+    }
+#endif
+
+#undef OP
+#undef NEXT
+}
+
+
+template<typename DoorT>
+void BasicCpu<DoorT>::doNmi()
+{
+    delay(7);
+
+    push16(PC_);
+    PUSH_P(/* b4= */ false);
+
+    PC_ = read16(VEC_NMI);
+
+    flagI_ = 1;
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::doIrq()
+{
+    delay(7);
+
+    push16(PC_);
+    PUSH_P(/* b4= */ false);
+
+    PC_ = read16(VEC_IRQ);
+
+    flagI_ = 1;
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::delay(int cycle)
+{
+    restCycle_ -= 3*cycle;
+
+    apuRestCycle_ += cycle;
+}
+
+/**
+ * 空ループ(VBLANK待ちの LDA $2002 / BPL や JMP * など)の早送り
+ *
+ * 後方ジャンプの直後に呼ぶ。前回の後方ジャンプからの1周で
+ *
+ *   - レジスタ、フラグ、PCが元に戻っている
+ *   - 外部状態を変えるアクセスをしていない
+ *   - APUを処理していない(IRQやDMAが起こっていない)
+ *   - 割り込み要求がない
+ *
+ * ならば、次のイベントまで全く同じ周回が繰り返されるので、その分のサ
+ * イクルを一度に消費する。周回の途中で止まるべき分(残りサイクル不足、
+ * APUイベント)は普通に実行するので、結果は1命令ずつ実行した場合と同じ
+ *
+ * フック設定時は全命令をフックに見せるため何もしない
+ */
+template<typename DoorT>
+void BasicCpu<DoorT>::checkIdleLoop()
+{
+    if(beforeExecHook_) return;
+
+    IdleSnapshot now;
+    now.valid        = true;
+    now.PC           = PC_;
+    now.A            = A_;
+    now.X            = X_;
+    now.Y            = Y_;
+    now.S            = S_;
+    now.P            = packP();
+    now.sideEffects  = door_->sideEffectCount();
+    now.apuTicks     = apuTicks_;
+    now.restCycle    = restCycle_;
+    now.apuRestCycle = apuRestCycle_;
+    now.apuPending   = apuPending_;
+
+    const IdleSnapshot& prev = idle_;
+    if(prev.valid && !nmi_ && !irq_ &&
+       prev.PC == now.PC && prev.A == now.A && prev.X == now.X && prev.Y == now.Y &&
+       prev.S == now.S && prev.P == now.P &&
+       prev.sideEffects == now.sideEffects && prev.apuTicks == now.apuTicks &&
+       prev.apuRestCycle == now.apuRestCycle){
+        int loopCycle = prev.restCycle - restCycle_;     // PPU cycle
+        int loopApu   = apuPending_ - prev.apuPending;   // CPU cycle
+        if(loopCycle > 0 && loopApu > 0){
+            // 各周回を最後まで実行できる(残りサイクルが3以上残る)回数
+            int n = (restCycle_ - 3) / loopCycle;
+            // APUイベントに達しない回数
+            n = min(n, (apuDeadline_ - 1 - apuPending_) / loopApu);
+            if(n > 0){
+                restCycle_  -= n * loopCycle;
+                apuPending_ += n * loopApu;
+                now.restCycle  = restCycle_;
+                now.apuPending = apuPending_;
+            }
+        }
+    }
+
+    idle_ = now;
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::fetchOp(uint8_t& opcode, uint16_t& arg)
+{
+    if((PC_ & 0x8000) && predecoded_){
+        const Decoded& d = romOps_[PC_ & 0x7FFF];
+        if(d.len){
+            opcode = d.opcode;
+            arg    = d.arg;
+            PC_ += d.len;
+            return;
+        }
+    }
+
+    opcode = read8(PC_++);
+
+    switch(OP_ARGLEN[opcode]){
+    case 0: arg = 0; break; // inline化時の未初期化警告抑止のため一応代入
+    case 1: arg = read8(PC_++); break;
+    case 2: arg = read16(PC_); PC_ += 2; break;
+    default: /* NOT REACHED */ assert(false); arg = 0; break;
+    }
+}
+
+
+template<typename DoorT>
+uint8_t BasicCpu<DoorT>::read8(uint16_t addr)
+{
+    return door_->read(addr);
+}
+
+/**
+ * ページ境界を越えてもよい(引数が $FFFF の場合、2Byte目は $0000)
+ */
+template<typename DoorT>
+uint16_t BasicCpu<DoorT>::read16(uint16_t addr)
+{
+    uint16_t addr_next = addr + 1;
+    return read8(addr) | (read8(addr_next)<<8);
+}
+
+/**
+ * ページ境界を越える場合、ページの先頭へループ
+ */
+template<typename DoorT>
+uint16_t BasicCpu<DoorT>::read16_inpage(uint16_t addr)
+{
+    uint16_t addr_next = (addr&0xFF00) | ((addr+1)&0xFF);
+    return read8(addr) | (read8(addr_next)<<8);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::write8(uint16_t addr, uint8_t value)
+{
+    door_->write(addr, value);
+}
+
+/**
+ * ページ境界を超えてもよい(引数が $FFFF の場合、2Byte目は $0000)
+ */
+template<typename DoorT>
+void BasicCpu<DoorT>::write16(uint16_t addr, uint16_t value)
+{
+    uint16_t addr_next = addr + 1;
+    write8(addr, value & 0xFF);
+    write8(addr_next, value >> 8);
+}
+
+/**
+ * ページ境界を越える場合、ページの先頭へループ
+ */
+template<typename DoorT>
+void BasicCpu<DoorT>::write16_inpage(uint16_t addr, uint16_t value)
+{
+    uint16_t addr_next = (addr&0xFF00) | ((addr+1)&0xFF);
+    write8(addr, value & 0xFF);
+    write8(addr_next, value >> 8);
+}
+
+template<typename DoorT>
+uint8_t BasicCpu<DoorT>::pop8()
+{
+    ++S_;
+    return read8(0x100 | S_);
+}
+
+// S == 0xFE の場合、$01FF, $0100 を読み取る
+template<typename DoorT>
+uint16_t BasicCpu<DoorT>::pop16()
+{
+    ++S_;
+    uint16_t addr = 0x100 | S_;
+    ++S_;
+    return read16_inpage(addr);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::push8(uint8_t value)
+{
+    write8(0x100 | S_--, value);
+}
+
+// S == 0 の場合、$0100, $01FF へ書き込む
+template<typename DoorT>
+void BasicCpu<DoorT>::push16(uint16_t value)
+{
+    --S_;
+    uint16_t addr = 0x100 | S_;
+    --S_;
+    write16_inpage(addr, value);
+}
+
+// ページ境界を越える場合、$00 へループ(サイクル数は同じ)
+template<typename DoorT>
+uint16_t BasicCpu<DoorT>::ADDR_ZPI(uint16_t arg, uint8_t idx)
+{
+    uint8_t addr = arg + idx;
+    return addr;
+}
+
+template<typename DoorT>
+uint16_t BasicCpu<DoorT>::ADDR_ZPX(uint16_t arg) { return ADDR_ZPI(arg, X_); }
+template<typename DoorT>
+uint16_t BasicCpu<DoorT>::ADDR_ZPY(uint16_t arg) { return ADDR_ZPI(arg, Y_); }
+
+/**
+ * readonlyな命令で使われる。FCEUXと同じ実装。
+ */
+template<typename DoorT>
+uint16_t BasicCpu<DoorT>::ADDR_ABI_READ(uint16_t arg, uint8_t idx)
+{
+    uint16_t addr = arg + idx;
+
+    // ページ境界を越えたら1サイクル余分に消費。また、投機実行による余
+    // 分な読み取りをエミュレート
+    if((arg ^ addr) & 0x100){
+        delay(1);
+        read8(addr ^ 0x100);
+    }
+
+    return addr;
+}
+
+template<typename DoorT>
+uint16_t BasicCpu<DoorT>::ADDR_ABX_READ(uint16_t arg) { return ADDR_ABI_READ(arg, X_); }
+template<typename DoorT>
+uint16_t BasicCpu<DoorT>::ADDR_ABY_READ(uint16_t arg) { return ADDR_ABI_READ(arg, Y_); }
+
+/**
+ * 書き込みを含む命令で使われる。FCEUXと同じ実装。
+ */
+template<typename DoorT>
+uint16_t BasicCpu<DoorT>::ADDR_ABI_WRITE(uint16_t arg, uint8_t idx)
+{
+    uint16_t addr = arg + idx;
+
+    // ページ境界を越えてもサイクル数は変わらない(書き込みでは投機実行
+    // ができないため)。ただし常にこの読み取りが発生
+    read8((arg&0xFF00) | (addr&0xFF));
+
+    return addr;
+}
+
+template<typename DoorT>
+uint16_t BasicCpu<DoorT>::ADDR_ABX_WRITE(uint16_t arg) { return ADDR_ABI_WRITE(arg, X_); }
+template<typename DoorT>
+uint16_t BasicCpu<DoorT>::ADDR_ABY_WRITE(uint16_t arg) { return ADDR_ABI_WRITE(arg, Y_); }
+
+template<typename DoorT>
+uint16_t BasicCpu<DoorT>::ADDR_IX(uint16_t arg)
+{
+    uint16_t ptr = ADDR_ZPX(arg);
+    return read16_inpage(ptr);
+}
+
+/**
+ * readonlyな命令で使われる。FCEUXと同じ実装。
+ */
+template<typename DoorT>
+uint16_t BasicCpu<DoorT>::ADDR_IY_READ(uint16_t arg)
+{
+    uint16_t addr_base = read16_inpage(arg);
+    uint16_t addr = addr_base + Y_;
+
+    // ページ境界を越えたら1サイクル余分に消費。また、投機実行による余
+    // 分な読み取りをエミュレート
+    if((addr_base ^ addr) & 0x100){
+        delay(1);
+        read8(addr ^ 0x100);
+    }
+
+    return addr;
+}
+
+/**
+ * 書き込みを含む命令で使われる。FCEUXと同じ実装。
+ */
+template<typename DoorT>
+uint16_t BasicCpu<DoorT>::ADDR_IY_WRITE(uint16_t arg)
+{
+    uint16_t addr_base = read16_inpage(arg);
+    uint16_t addr = addr_base + Y_;
+
+    // ページ境界を越えてもサイクル数は変わらない(書き込みでは投機実行
+    // ができないため)。ただし常にこの読み取りが発生
+    read8((addr_base&0xFF00) | (addr&0xFF));
+
+    return addr;
+}
+
+template<typename DoorT>
+uint8_t BasicCpu<DoorT>::LD_ZP(uint16_t arg)  { return read8(arg); }
+template<typename DoorT>
+uint8_t BasicCpu<DoorT>::LD_ZPX(uint16_t arg) { return read8(ADDR_ZPX(arg)); }
+template<typename DoorT>
+uint8_t BasicCpu<DoorT>::LD_ZPY(uint16_t arg) { return read8(ADDR_ZPY(arg)); }
+template<typename DoorT>
+uint8_t BasicCpu<DoorT>::LD_AB(uint16_t arg)  { return read8(arg); }
+template<typename DoorT>
+uint8_t BasicCpu<DoorT>::LD_ABX(uint16_t arg) { return read8(ADDR_ABX_READ(arg)); }
+template<typename DoorT>
+uint8_t BasicCpu<DoorT>::LD_ABY(uint16_t arg) { return read8(ADDR_ABY_READ(arg)); }
+template<typename DoorT>
+uint8_t BasicCpu<DoorT>::LD_IX(uint16_t arg)  { return read8(ADDR_IX(arg)); }
+template<typename DoorT>
+uint8_t BasicCpu<DoorT>::LD_IY(uint16_t arg)  { return read8(ADDR_IY_READ(arg)); }
+
+template<typename DoorT>
+void BasicCpu<DoorT>::ST_ZP(uint16_t arg, uint8_t value)  { write8(arg, value); }
+template<typename DoorT>
+void BasicCpu<DoorT>::ST_ZPX(uint16_t arg, uint8_t value) { write8(ADDR_ZPX(arg), value); }
+template<typename DoorT>
+void BasicCpu<DoorT>::ST_ZPY(uint16_t arg, uint8_t value) { write8(ADDR_ZPY(arg), value); }
+template<typename DoorT>
+void BasicCpu<DoorT>::ST_AB(uint16_t arg, uint8_t value)  { write8(arg, value); }
+template<typename DoorT>
+void BasicCpu<DoorT>::ST_ABX(uint16_t arg, uint8_t value) { write8(ADDR_ABX_WRITE(arg), value); }
+template<typename DoorT>
+void BasicCpu<DoorT>::ST_ABY(uint16_t arg, uint8_t value) { write8(ADDR_ABY_WRITE(arg), value); }
+template<typename DoorT>
+void BasicCpu<DoorT>::ST_IX(uint16_t arg, uint8_t value)  { write8(ADDR_IX(arg), value); }
+template<typename DoorT>
+void BasicCpu<DoorT>::ST_IY(uint16_t arg, uint8_t value)  { write8(ADDR_IY_WRITE(arg), value); }
+
+template<typename DoorT>
+auto BasicCpu<DoorT>::AV_READ(uint16_t addr) -> AddrValue
+{
+    return AddrValue{ addr, read8(addr) };
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::AV_WRITE(AddrValue av)
+{
+    write8(av.addr, av.value);
+}
+
+template<typename DoorT>
+auto BasicCpu<DoorT>::RMW_ZP(uint16_t arg) -> AddrValue
+{
+    AddrValue av = AV_READ(arg);
+    //write8(av.addr, av.value); // zeropageなのでRMWW動作は省略
+    return av;
+}
+
+template<typename DoorT>
+auto BasicCpu<DoorT>::RMW_ZPX(uint16_t arg) -> AddrValue
+{
+    AddrValue av = AV_READ(ADDR_ZPX(arg));
+    //write8(av.addr, av.value); // zeropageなのでRMWW動作は省略
+    return av;
+}
+
+template<typename DoorT>
+auto BasicCpu<DoorT>::RMW_AB(uint16_t arg) -> AddrValue
+{
+    AddrValue av = AV_READ(arg);
+    write8(av.addr, av.value); // RMWW
+    return av;
+}
+
+template<typename DoorT>
+auto BasicCpu<DoorT>::RMW_ABX(uint16_t arg) -> AddrValue
+{
+    AddrValue av = AV_READ(ADDR_ABX_WRITE(arg));
+    write8(av.addr, av.value); // RMWW
+    return av;
+}
+
+// 一部の非公式命令のみで使われる
+template<typename DoorT>
+auto BasicCpu<DoorT>::RMW_ABY(uint16_t arg) -> AddrValue
+{
+    AddrValue av = AV_READ(ADDR_ABY_WRITE(arg));
+    write8(av.addr, av.value); // RMWW
+    return av;
+}
+
+template<typename DoorT>
+auto BasicCpu<DoorT>::RMW_IX(uint16_t arg) -> AddrValue
+{
+    AddrValue av = AV_READ(ADDR_IX(arg));
+    write8(av.addr, av.value); // RMWW
+    return av;
+}
+
+template<typename DoorT>
+auto BasicCpu<DoorT>::RMW_IY(uint16_t arg) -> AddrValue
+{
+    AddrValue av = AV_READ(ADDR_IY_WRITE(arg));
+    write8(av.addr, av.value); // RMWW
+    return av;
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::ZN_UPDATE(uint8_t value)
+{
+    zRes_ = nRes_ = value;
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::LDA(uint8_t value)
+{
+    A_ = value;
+    ZN_UPDATE(A_);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::LDX(uint8_t value)
+{
+    X_ = value;
+    ZN_UPDATE(X_);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::LDY(uint8_t value)
+{
+    Y_ = value;
+    ZN_UPDATE(Y_);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::ADC(uint8_t value)
+{
+    unsigned int result = A_ + value + flagC_;
+
+    flagC_ = bool(result&0x100);
+    flagV_ = (((A_^value)&0x80)^0x80) && ((A_^result)&0x80);
+
+    A_ = result & 0xFF;
+    ZN_UPDATE(A_);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::SBC(uint8_t value)
+{
+    unsigned int result = A_ - value - !flagC_;
+
+    flagC_ = !(result & 0x100);
+    flagV_ = bool((A_^value) & (A_^result) & 0x80);
+
+    A_ = result & 0xFF;
+    ZN_UPDATE(A_);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::ORA(uint8_t value)
+{
+    A_ |= value;
+    ZN_UPDATE(A_);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::AND(uint8_t value)
+{
+    A_ &= value;
+    ZN_UPDATE(A_);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::EOR(uint8_t value)
+{
+    A_ ^= value;
+    ZN_UPDATE(A_);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::ASL_DO(uint8_t& value)
+{
+    flagC_ = bool(value&0x80);
+    value <<= 1;
+    ZN_UPDATE(value);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::ASL()
+{
+    ASL_DO(A_);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::ASL(AddrValue av)
+{
+    ASL_DO(av.value);
+    AV_WRITE(av);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::LSR_DO(uint8_t& value)
+{
+    flagC_ = value & 1;
+    value >>= 1;
+    ZN_UPDATE(value);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::LSR()
+{
+    LSR_DO(A_);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::LSR(AddrValue av)
+{
+    LSR_DO(av.value);
+    AV_WRITE(av);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::ROL_DO(uint8_t& value)
+{
+    bool c_result = value & 0x80;
+    value <<= 1;
+    value |= flagC_;
+    flagC_ = c_result;
+    ZN_UPDATE(value);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::ROL()
+{
+    ROL_DO(A_);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::ROL(AddrValue av)
+{
+    ROL_DO(av.value);
+    AV_WRITE(av);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::ROR_DO(uint8_t& value)
+{
+    bool c_result = value & 1;
+    value >>= 1;
+    value |= flagC_ << 7;
+    flagC_ = c_result;
+    ZN_UPDATE(value);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::ROR()
+{
+    ROR_DO(A_);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::ROR(AddrValue av)
+{
+    ROR_DO(av.value);
+    AV_WRITE(av);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::BIT(uint8_t value)
+{
+    zRes_ = A_ & value;
+    nRes_ = value;
+
+    Status p(value);
+    flagV_ = p.V;
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::INC_DO(uint8_t& value)
+{
+    ++value;
+    ZN_UPDATE(value);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::INC(AddrValue av)
+{
+    INC_DO(av.value);
+    AV_WRITE(av);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::DEC_DO(uint8_t& value)
+{
+    --value;
+    ZN_UPDATE(value);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::DEC(AddrValue av)
+{
+    DEC_DO(av.value);
+    AV_WRITE(av);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::CMP_DO(uint8_t lhs, uint8_t rhs)
+{
+    unsigned int result = lhs - rhs;
+    flagC_ = !(result & 0x100);
+    ZN_UPDATE(result & 0xFF);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::CMP(uint8_t value)
+{
+    CMP_DO(A_, value);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::CPX(uint8_t value)
+{
+    CMP_DO(X_, value);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::CPY(uint8_t value)
+{
+    CMP_DO(Y_, value);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::BRANCH(uint16_t arg, bool cond)
+{
+    if(cond){
+        delay(1);
+        int8_t disp = static_cast<int8_t>(arg);
+        uint16_t dst = PC_ + disp;
+        if((PC_ ^ dst) & 0x100)
+            delay(1);
+        PC_ = dst;
+        if(disp < 0) checkIdleLoop();
+    }
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::JMP_AB(uint16_t arg)
+{
+    bool backward = arg < PC_;
+    PC_ = arg;
+    if(backward) checkIdleLoop();
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::JMP_IND(uint16_t arg)
+{
+    PC_ = read16_inpage(arg);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::JSR(uint16_t arg)
+{
+    push16((PC_-1) & 0xFFFF);
+    PC_ = arg;
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::RTS()
+{
+    PC_ = pop16();
+    ++PC_;
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::RTI()
+{
+    POP_P();
+    PC_ = pop16();
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::BRK()
+{
+    push16(PC_);
+    PUSH_P(/* b4= */ true);
+
+    PC_ = read16(VEC_IRQ);
+
+    flagI_ = 1;
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::POP_P()
+{
+    // ignore bit5-4
+    unpackP(pop8());
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::PUSH_P(bool b4)
+{
+    Status p(packP());
+    p.b4 = b4;
+    push8(p.raw);
+}
+
+/**
+ * ステータスレジスタをバイトにまとめる
+ * b4 は常に1を返す(push時は呼び出し側で設定すること)
+ */
+template<typename DoorT>
+uint8_t BasicCpu<DoorT>::packP() const
+{
+    Status p;
+    p.C  = flagC_;
+    p.Z  = !zRes_;
+    p.I  = flagI_;
+    p.D  = flagD_;
+    p.b4 = 1;
+    p.b5 = 1;
+    p.V  = flagV_;
+    p.N  = nRes_ >> 7;
+    return p.raw;
+}
+
+// bit5-4 は無視
+template<typename DoorT>
+void BasicCpu<DoorT>::unpackP(uint8_t value)
+{
+    Status p(value);
+    flagC_ = p.C;
+    flagI_ = p.I;
+    flagD_ = p.D;
+    flagV_ = p.V;
+    zRes_  = !p.Z;
+    nRes_  = p.N << 7;
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::KIL()
+{
+    delay(0xFF);
+    jammed_ = true;
+    --PC_;
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::ALR(uint8_t value)
+{
+    A_ &= value;
+    LSR();
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::ANC(uint8_t value)
+{
+    AND(value);
+    flagC_ = nRes_ >> 7;
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::ARR(uint8_t value)
+{
+    A_ &= value;
+    A_ >>= 1;
+    A_ |= flagC_ << 7;
+    ZN_UPDATE(A_);
+    flagC_ = bool(A_&0x40);
+    flagV_ = bool((A_^(A_>>1))&0x20);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::AXS(uint8_t value)
+{
+    unsigned int result = (A_&X_) - value;
+    flagC_ = !(result & 0x100);
+    X_ = result & 0xFF;
+    ZN_UPDATE(X_);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::LAX(uint8_t value)
+{
+    A_ = X_ = value;
+    ZN_UPDATE(A_);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::DCP(AddrValue av)
+{
+    --av.value;
+    CMP(av.value);
+    AV_WRITE(av);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::ISC(AddrValue av)
+{
+    ++av.value;
+    SBC(av.value);
+    AV_WRITE(av);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::RLA(AddrValue av)
+{
+    bool c_result = av.value & 0x80;
+    av.value <<= 1;
+    av.value |= flagC_;
+    flagC_ = c_result;
+    AND(av.value);
+    AV_WRITE(av);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::RRA(AddrValue av)
+{
+    bool c_result = av.value & 1;
+    av.value >>= 1;
+    av.value |= flagC_ << 7;
+    flagC_ = c_result;
+    ADC(av.value);
+    AV_WRITE(av);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::SLO(AddrValue av)
+{
+    flagC_ = bool(av.value&0x80);
+    av.value <<= 1;
+    AV_WRITE(av);
+    ORA(av.value);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::SRE(AddrValue av)
+{
+    flagC_ = av.value & 1;
+    av.value >>= 1;
+    EOR(av.value);
+    AV_WRITE(av);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::LAS(uint16_t arg)
+{
+    // FCEUXと同じ
+    // 本当はページまたぎの場合1サイクルのペナルティがかかる?
+    AddrValue av = RMW_ABY(arg);
+    A_ = X_ = S_ = S_ & av.value;
+    ZN_UPDATE(A_);
+    AV_WRITE(av);
+}
+
+template<typename DoorT>
+uint8_t BasicCpu<DoorT>::AHX_VALUE(uint16_t arg)
+{
+    return A_ & X_ & (((arg-Y_)>>8)+1);
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::AHX_ABY(uint16_t arg)
+{
+    ST_ABY(arg, AHX_VALUE(arg));
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::AHX_IY(uint16_t arg)
+{
+    ST_IY(arg, AHX_VALUE(arg));
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::TAS(uint16_t arg)
+{
+    S_ = A_ & X_;
+    ST_ABY(arg, S_ & (((arg-Y_)>>8)+1));
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::SHX(uint16_t arg)
+{
+    ST_ABY(arg, X_ & (((arg-Y_)>>8)+1));
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::SHY(uint16_t arg)
+{
+    ST_ABX(arg, Y_ & (((arg-X_)>>8)+1));
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::LAX_IM(uint16_t arg)
+{
+    A_ |= 0xFF;
+    AND(arg);
+    X_ = A_;
+}
+
+template<typename DoorT>
+void BasicCpu<DoorT>::XAA(uint16_t arg)
+{
+    A_ |= 0xEE;
+    A_ &= X_;
+    AND(arg);
+}
@@ -1,25 +1,43 @@
 #pragma once
 
+#include <array>
 #include <memory>
 #include <cstdint>
 
 #include "junknes.h"
 #include "util.hpp"
 
-class Cpu{
+// CPUから外部へアクセスするためのインターフェース(仮想関数版)
+class CpuBus{
 public:
-    // CPUから外部へアクセスするためのインターフェース
-    class Door{
-    public:
-        virtual ~Door();
-        virtual std::uint8_t read(std::uint16_t addr) = 0;
-        virtual void write(std::uint16_t addr, std::uint8_t value) = 0;
-
-        // 1命令ごとにAPUを処理する。FCEUXのパクリ
-        virtual void tickApu(int cycle /* CPU cycle */) = 0;
-    };
+    virtual ~CpuBus();
+    virtual std::uint8_t read(std::uint16_t addr) = 0;
+    virtual void write(std::uint16_t addr, std::uint8_t value) = 0;
+
+    // APUを処理する。FCEUXのパクリだが、イベントがない間はまとめて呼ばれる
+    virtual void tickApu(int cycle /* CPU cycle */) = 0;
+    // 次にAPUのイベントが起こるまでのCPUサイクル数
+    // これ未満のサイクル数なら tickApu() をまとめて呼んでも結果は同じ
+    virtual int apuNextEvent() = 0;
+
+    // 外部状態を変えうるアクセス(書き込み、副作用のある読み取り)の
+    // 累計回数。空ループ検出に使う
+    virtual unsigned int sideEffectCount() = 0;
+};
+
+/**
+ * 6502
+ *
+ * DoorT は外部アクセス用の型で、CpuBus と同じメンバ関数を持つこと
+ * 具象クラス(final)を渡せば仮想関数呼び出しがなくなり、インライン化も
+ * 可能になる。実装は cpu-impl.hpp
+ */
+template<typename DoorT>
+class BasicCpu{
+public:
+    using Door = DoorT;
 
-    explicit Cpu(const std::shared_ptr<Door>& door);
+    explicit BasicCpu(const std::shared_ptr<Door>& door);
 
     void hardReset();
     void softReset();
@@ -30,17 +48,43 @@ public:
     void oamDmaDelay();
     void dmcDmaDelay(int cycle /* CPU cycle */);
 
+    void syncApu();
+
     void exec(int cycle /* PPU cycle */);
 
+    // 実行中の命令の開始時点での残りサイクル(PPU cycle)
+    // バスアクセスがスライス内のどの時刻に起きたかの計算用
+    int restCycleAtOp() const;
+    // exec() 実行中に残りサイクルを減らし、その分早く戻らせる
+    void cutSlice(int cycle /* PPU cycle */);
+
     void beforeExec(JunknesCpuHook hook, void* userdata);
 
+    // $8000-$FFFF が不変(ROM)であることを前提に、全アドレスの命令をデコー
+    // ドしておく。rom は32KB
+    void predecode(const std::uint8_t* rom);
+
 private:
+    // プリデコード済み命令。len == 0 ならオペランドが $FFFF を跨ぐので通
+    // 常のフェッチを行う
+    struct Decoded{
+        std::uint8_t opcode;
+        std::uint8_t len; // オペコードを含むバイト数
+        std::uint16_t arg;
+    };
+
     void doNmi();
     void doIrq();
 
     void delay(int cycle /* CPU cycle */);
 
+    void checkIdleLoop();
+
     void fetchOp(std::uint8_t& opcode, std::uint16_t& operand);
+    void tickOp(int cycle /* CPU cycle */);
+    template<bool Traced> bool beginOp(std::uint8_t& opcode, std::uint16_t& arg);
+    template<bool Traced> bool stepOp(std::uint8_t& opcode, std::uint16_t& arg);
+    template<bool Traced> void execLoop();
 
     JunknesCpuState state() const;
 
@@ -153,6 +197,8 @@ private:
 
     void PUSH_P(bool b4);
     void POP_P();
+    std::uint8_t packP() const;
+    void unpackP(std::uint8_t value);
 
     // unofficial
     void KIL();
@@ -186,8 +232,10 @@ private:
 
     JunknesCpuHook beforeExecHook_;
     void* beforeExecData_;
+    void (BasicCpu::*execLoop_)(); // execLoop<true> or execLoop<false>
 
     int restCycle_; // PPU cycle
+    int opRestCycle_; // restCycleAtOp()
 
     bool nmi_;
     bool irq_;
@@ -198,6 +246,7 @@ private:
     std::uint8_t Y_;
     std::uint8_t S_;
 
+    // ステータスレジスタをバイトとして扱うとき用
     union Status{
         std::uint8_t raw;
         explicit Status(std::uint8_t value=0) : raw(value) {};
@@ -211,9 +260,39 @@ private:
         BitField8<6> V;
         BitField8<7> N;
     };
-    Status P_;
+
+    // ステータスレジスタ
+    // N, Z は演算のたびに計算せず、結果の値を覚えておいて参照時に求める
+    std::uint8_t nRes_; // bit7 が N
+    std::uint8_t zRes_; // 0 なら Z
+    bool flagC_;
+    bool flagI_;
+    bool flagD_;
+    bool flagV_;
 
     bool jammed_;
 
     int apuRestCycle_; // CPU cycle
+    int apuPending_;   // まだAPUに渡していないCPUサイクル
+    int apuDeadline_;  // apuPending_ がこれに達したらAPUを処理する
+    unsigned int apuTicks_; // 実際にAPUを処理した回数
+
+    // 空ループ検出用。後方ジャンプ直後の状態を記録し、次に同じ後方ジャ
+    // ンプをしたときと比較する
+    struct IdleSnapshot{
+        bool valid;
+        std::uint16_t PC;
+        std::uint8_t A, X, Y, S, P;
+        unsigned int sideEffects;
+        unsigned int apuTicks;
+        int restCycle;
+        int apuRestCycle;
+        int apuPending;
+    };
+    IdleSnapshot idle_;
+
+    bool predecoded_;
+    std::array<Decoded, 0x8000> romOps_; // $8000-$FFFF
 };
+
+using Cpu = BasicCpu<CpuBus>;
@@ -1,11 +1,18 @@
 #include <array>
 #include <algorithm>
+#include <vector>
 #include <cstdint>
 
 #include <boost/lockfree/spsc_queue.hpp>
 
+#if defined(__SSE2__)
+#   define JUNKNES_MIXER_SSE2
+#   include <emmintrin.h>
+#endif
+
 #include "junknes.h"
 #include "nes.hpp"
+#include "resample.hpp"
 
 using namespace std;
 
@@ -56,20 +63,70 @@ extern "C" const uint8_t* junknes_screen(const struct Junknes* nes)
     return nes->impl.screen();
 }
 
+extern "C" const uint8_t* junknes_ram(const struct Junknes* nes)
+{
+    return nes->impl.ram();
+}
+
 extern "C" void junknes_sound(const struct Junknes* nes, struct JunknesSound* sound)
 {
     *sound = nes->impl.sound();
 }
 
+extern "C" void junknes_set_sample_rate(struct Junknes* nes, int freq)
+{
+    nes->impl.setSampleRate(freq);
+}
+
+extern "C" int junknes_read_samples(struct Junknes* nes, int16_t* buf, int max)
+{
+    if(max <= 0) return 0;
+
+    return nes->impl.readSamples(buf, max);
+}
+
+extern "C" void junknes_set_audio_mode(struct Junknes* nes, enum JunknesAudioMode mode)
+{
+    if(!(mode == JUNKNES_AUDIO_ON || mode == JUNKNES_AUDIO_OFF)) return;
+
+    nes->impl.setSoundOff(mode == JUNKNES_AUDIO_OFF);
+}
+
+extern "C" int junknes_frame_unchanged(const struct Junknes* nes)
+{
+    return nes->impl.frameUnchanged() ? 1 : 0;
+}
+
 extern "C" void junknes_before_exec(struct Junknes* nes, JunknesCpuHook hook, void* userdata)
 {
     nes->impl.beforeExec(hook, userdata);
 }
 
+extern "C" void junknes_set_sprite_limit(struct Junknes* nes, int enabled)
+{
+    nes->impl.setSpriteLimit(enabled != 0);
+}
+
+extern "C" void junknes_set_render_mode(struct Junknes* nes, int mode)
+{
+    if(mode < JUNKNES_RENDER_OFF) return;
+
+    nes->impl.setRenderMode(mode);
+}
+
+extern "C" void junknes_set_render_thread(struct Junknes* nes, int enabled)
+{
+    nes->impl.setRenderThread(enabled != 0);
+}
+
 
 namespace{
     constexpr int NES_W = 256;
     constexpr int NES_H = 240;
+
+    constexpr double CPU_FREQ = 6.0 * 39375000.0/11.0 / 12.0;
+
+    constexpr int MIXER_QUALITY_DEFAULT = 1;
 }
 
 struct JunknesBlit{
@@ -77,26 +134,32 @@ struct JunknesBlit{
     array<uint32_t, 0x40> palette;
 };
 
+// キューはByte単位(サンプル形式によらない)
 struct JunknesMixer{
-    JunknesMixer(int freq_arg, int bufsize_arg, int fps_arg)
-        : freq(freq_arg), bufsize(bufsize_arg), fps(fps_arg), offset(0),
-          queue(16*freq/fps) {} // とりあえずキューサイズは多めで
+    JunknesMixer(int freq_arg, int bufsize_arg, int fps_arg, JunknesSampleFormat format_arg)
+        : freq(freq_arg), bufsize(bufsize_arg), fps(fps_arg), format(format_arg),
+          sample_size(format == JUNKNES_SAMPLE_F32 ? sizeof(float) : sizeof(int16_t)),
+          resampler(CPU_FREQ, freq, MIXER_QUALITY_DEFAULT),
+          queue(16*freq/fps * sample_size) {} // とりあえずキューサイズは多めで
     int freq;
     int bufsize;
     int fps;
-    int offset;
-    boost::lockfree::spsc_queue<int16_t> queue;
+    JunknesSampleFormat format;
+    int sample_size;
+    Resampler resampler;
+    vector<float> mixed; // resampler の出力
+    boost::lockfree::spsc_queue<uint8_t> queue;
 };
 
 namespace{
     void palette_convert_32(const JunknesRgb* master, array<uint32_t, 0x40>& target,
-                            int rshift, int gshift, int bshift)
+                            int rshift, int gshift, int bshift, uint32_t alpha)
     {
         for(int i = 0; i < 0x40; ++i){
-            uint8_t r = master[i].r;
-            uint8_t g = master[i].g;
-            uint8_t b = master[i].b;
-            target[i] = (r<<rshift) | (g<<gshift) | (b<<bshift);
+            uint32_t r = master[i].r;
+            uint32_t g = master[i].g;
+            uint32_t b = master[i].b;
+            target[i] = (r<<rshift) | (g<<gshift) | (b<<bshift) | alpha;
         }
     }
 }
@@ -107,18 +170,25 @@ extern "C" struct JunknesBlit* junknes_blit_create(const struct JunknesRgb* pale
     array<uint32_t, 0x40> palette_target;
 
     int rshift, gshift, bshift;
+    uint32_t alpha = 0;
     switch(format){
     case JUNKNES_PIXEL_XRGB8888:
         rshift = 16;
         gshift =  8;
         bshift =  0;
         break;
+    case JUNKNES_PIXEL_RGBA8888:
+        rshift = 24;
+        gshift = 16;
+        bshift =  8;
+        alpha  = 0xFF;
+        break;
     default:
         // not supported
         return nullptr;
     }
 
-    palette_convert_32(palette, palette_target, rshift, gshift, bshift);
+    palette_convert_32(palette, palette_target, rshift, gshift, bshift, alpha);
     return new JunknesBlit(palette_target);
 }
 
@@ -140,12 +210,37 @@ extern "C" void junknes_blit_do(struct JunknesBlit* blit,
                     *p++ = blit->palette[src[NES_W*y + x]];
 }
 
+extern "C" void junknes_set_screen_target(struct Junknes* nes, const struct JunknesBlit* blit,
+                                          void* dst, int pitch)
+{
+    if(!dst){
+        nes->impl.setScreenTarget(nullptr, nullptr, 0);
+        return;
+    }
+    if(!blit) return;
+    if(pitch < static_cast<int>(sizeof(uint32_t)) * NES_W) return;
+
+    nes->impl.setScreenTarget(blit->palette.data(), dst, pitch);
+}
+
+extern "C" void junknes_set_screen_target_persistent(struct Junknes* nes, int persistent)
+{
+    nes->impl.setScreenTargetPersistent(persistent != 0);
+}
+
 extern "C" struct JunknesMixer* junknes_mixer_create(int freq, int bufsize, int fps)
+{
+    return junknes_mixer_create_format(freq, bufsize, fps, JUNKNES_SAMPLE_S16);
+}
+
+extern "C" struct JunknesMixer* junknes_mixer_create_format(int freq, int bufsize, int fps,
+                                                           enum JunknesSampleFormat format)
 {
     if(freq <= 0) return nullptr;
     if(bufsize <= 0) return nullptr;
     if(fps <= 0) return nullptr;
-    return new JunknesMixer(freq, bufsize, fps);
+    if(!(format == JUNKNES_SAMPLE_S16 || format == JUNKNES_SAMPLE_F32)) return nullptr;
+    return new JunknesMixer(freq, bufsize, fps, format);
 }
 
 extern "C" void junknes_mixer_destroy(struct JunknesMixer* mixer)
@@ -153,63 +248,104 @@ extern "C" void junknes_mixer_destroy(struct JunknesMixer* mixer)
     delete mixer;
 }
 
+extern "C" void junknes_mixer_set_quality(struct JunknesMixer* mixer, int quality)
+{
+    if(!(0 <= quality && quality <= JUNKNES_MIXER_QUALITY_MAX)) return;
+
+    mixer->resampler = Resampler(CPU_FREQ, mixer->freq, quality);
+}
+
+namespace{
+    // まとめてミックス、変換するサンプル数
+    constexpr int MIX_BLOCK = 256;
+
+    // 出力レベル [0,1) の0.5を中心にした振幅
+    constexpr float MIX_AMP_S16 = 20000;
+    constexpr float MIX_AMP_F32 = MIX_AMP_S16 / 32768;
+
+    void convertS16(const float* in, int n, int16_t* out)
+    {
+        int i = 0;
+#ifdef JUNKNES_MIXER_SSE2
+        // 8サンプルずつ。PACKSSDW で飽和しつつ16bitに詰める
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128 amp  = _mm_set1_ps(MIX_AMP_S16);
+        for(; i+8 <= n; i += 8){
+            __m128 lo = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(in+i),   half), amp);
+            __m128 hi = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(in+i+4), half), amp);
+            __m128i s = _mm_packs_epi32(_mm_cvttps_epi32(lo), _mm_cvttps_epi32(hi));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out+i), s);
+        }
+#endif
+        for(; i < n; ++i)
+            out[i] = static_cast<int16_t>(MIX_AMP_S16 * (in[i]-0.5f));
+    }
+
+    void convertF32(const float* in, int n, float* out)
+    {
+        int i = 0;
+#ifdef JUNKNES_MIXER_SSE2
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128 amp  = _mm_set1_ps(MIX_AMP_F32);
+        for(; i+4 <= n; i += 4)
+            _mm_storeu_ps(out+i, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(in+i), half), amp));
+#endif
+        for(; i < n; ++i)
+            out[i] = MIX_AMP_F32 * (in[i]-0.5f);
+    }
+}
+
 extern "C" void junknes_mixer_push(struct JunknesMixer* mixer, const struct JunknesSound* sound)
 {
     int len = sound->sq1.len;
-
-    static constexpr double CPU_FREQ = 6.0 * 39375000.0/11.0 / 12.0;
-    double step = CPU_FREQ / mixer->freq;
-
-    int n_sample = static_cast<int>((len-mixer->offset) / step);
-    // TODO: 1step未満の場合の offset 補正(起こり得ないとは思うが…)
-    if(n_sample <= 0) return;
-
-    double pos = mixer->offset;
-    int n_push = 0;
-    while(n_push < n_sample){
-        int pos_int = static_cast<int>(pos);
-        uint8_t v_sq1 = sound->sq1.data[pos_int]; // [0, 15]
-        uint8_t v_sq2 = sound->sq2.data[pos_int]; // [0, 15]
-        uint8_t v_tri = sound->tri.data[pos_int]; // [0, 15]
-        uint8_t v_noi = sound->noi.data[pos_int]; // [0, 15]
-        uint8_t v_dmc = sound->dmc.data[pos_int]; // [0,127]
-
-        // http://wiki.nesdev.com/w/index.php/APU_Mixer
-        double mixed = 0.00752*(v_sq1+v_sq2) + 0.00851*v_tri + 0.00494*v_noi + 0.00335*v_dmc;
-        int16_t sample = 20000 * (mixed-0.5);
-
-        if(mixer->queue.push(sample)){
-            ++n_push;
-            pos += step;
+    if(len <= 0) return;
+
+    // ミックスと間引きは resampler で。出力位置の端数はそちらで持ち越す
+    int max_sample = mixer->resampler.maxOutput(len);
+    if(static_cast<int>(mixer->mixed.size()) < max_sample)
+        mixer->mixed.resize(max_sample);
+    int n_sample = mixer->resampler.process(*sound, mixer->mixed.data());
+
+    // キューに入りきらない分は捨てる
+    int n_room = mixer->queue.write_available() / mixer->sample_size;
+    int n_push = min(n_sample, n_room);
+
+    union{
+        array<int16_t, MIX_BLOCK> s16;
+        array<float, MIX_BLOCK> f32;
+    } out;
+
+    // 変換はブロック単位でまとめて
+    for(int done = 0; done < n_push; ){
+        int n = min(MIX_BLOCK, n_push-done);
+        const float* mixed = mixer->mixed.data() + done;
+
+        const uint8_t* bytes;
+        if(mixer->format == JUNKNES_SAMPLE_F32){
+            convertF32(mixed, n, out.f32.data());
+            bytes = reinterpret_cast<const uint8_t*>(out.f32.data());
         }
         else{
-            // overflow
-            break;
+            convertS16(mixed, n, out.s16.data());
+            bytes = reinterpret_cast<const uint8_t*>(out.s16.data());
         }
-    }
+        mixer->queue.push(bytes, n * mixer->sample_size);
 
-    if(n_push == n_sample){
-        mixer->offset = static_cast<int>(step - (len-pos));
-    }
-    else{
-        // overflow
-        // データを捨てるので offset もリセット
-        mixer->offset = 0;
+        done += n;
     }
 }
 
 extern "C" void junknes_mixer_pull_sdl(void* userdata, uint8_t* stream, int len)
 {
     assert(userdata != nullptr);
-    assert(!(len&1));
 
     JunknesMixer* mixer = reinterpret_cast<JunknesMixer*>(userdata);
-    unsigned int n_sample = len / 2;
+    assert(len % mixer->sample_size == 0);
 
-    int16_t* p = reinterpret_cast<int16_t*>(stream);
-    size_t n_pop = mixer->queue.pop(p, n_sample);
-    if(n_pop < n_sample){
+    // 無音はどちらの形式でも全bit 0
+    size_t n_pop = mixer->queue.pop(stream, len);
+    if(n_pop < static_cast<size_t>(len)){
         // underflow
-        fill_n(p+n_pop, 0, n_sample-n_pop);
+        fill(stream+n_pop, stream+len, 0);
     }
 }
@@ -69,10 +69,75 @@ JUNKNES_API void junknes_emulate_frame(struct Junknes* nes);
 JUNKNES_API void junknes_set_input(struct Junknes* nes, int port, unsigned int input);
 
 JUNKNES_API const uint8_t* junknes_screen(const struct Junknes* nes); // size: 256*240
+JUNKNES_API const uint8_t* junknes_ram(const struct Junknes* nes); // size: 0x800
 JUNKNES_API void junknes_sound(const struct Junknes* nes, struct JunknesSound* sound);
 
+/**
+ * 帯域制限合成による音声出力(デフォルトは無効)
+ * freq > 0 で有効化し、freq Hz のサンプル(int16_t, モノラル)を生成す
+ * る。チャンネルは出力が変化した時だけ処理され、有効な間は
+ * junknes_sound() のサンプル列は空(len == 0)になる。freq <= 0 で無効化
+ *
+ * junknes_read_samples() は読み出したサンプル数を返す。毎フレーム読み出
+ * すこと(読み出されない分は一定量を超えると古い方から捨てられる)
+ */
+JUNKNES_API void junknes_set_sample_rate(struct Junknes* nes, int freq);
+JUNKNES_API int junknes_read_samples(struct Junknes* nes, int16_t* buf, int max);
+
+/**
+ * 音声モード(デフォルトは JUNKNES_AUDIO_ON)
+ *
+ * JUNKNES_AUDIO_OFF では音声を一切生成しない(junknes_sound() のサンプル
+ * 列は空、junknes_read_samples() は0)。length counter, フレームIRQ,
+ * $4015 の読み取り値、DMCのDMA/IRQのタイミングは変わらないので、CPUか
+ * ら見た動作は JUNKNES_AUDIO_ON と同一
+ */
+enum JunknesAudioMode{
+    JUNKNES_AUDIO_ON  = 0,
+    JUNKNES_AUDIO_OFF = 1
+};
+JUNKNES_API void junknes_set_audio_mode(struct Junknes* nes, enum JunknesAudioMode mode);
+
+// 直前の junknes_emulate_frame() でスクリーンが更新されなかったら非0
+// (静止画面やフレームスキップ時)。その場合 junknes_blit_do() やテクス
+// チャの転送は省略してよい
+// junknes_screen() についての値で、junknes_set_screen_target() の描画先
+// は junknes_set_screen_target_persistent() を指定しない限り毎フレーム
+// 全体が書き直される
+// 変化のないラインはハッシュで検出するので、衝突に備えて一定フレーム
+// (64回描画)ごとに全体を描画し直す。そのフレームでは 0 になる
+JUNKNES_API int junknes_frame_unchanged(const struct Junknes* nes);
+
 JUNKNES_API void junknes_before_exec(struct Junknes* nes, JunknesCpuHook hook, void* userdata);
 
+// 1ラインあたり8スプライトの制限(実機どおり。デフォルトは 0 で無制限)
+// 有効にすると、各ラインで番号順に9個目以降のスプライトは表示されない
+JUNKNES_API void junknes_set_sprite_limit(struct Junknes* nes, int enabled);
+
+/**
+ * 描画モード(デフォルトは JUNKNES_RENDER_FULL)
+ *
+ * JUNKNES_RENDER_FULL : 毎フレーム描画
+ * JUNKNES_RENDER_OFF  : 描画しない
+ * 正の値 N            : Nフレーム飛ばして1フレーム描画
+ *
+ * 描画しないフレームでもゲームから見える状態(スクロールレジスタ、スプ
+ * ライト0ヒット)は描画時と同じに保たれる。スクリーンバッファは最後に
+ * 描画したフレームのまま
+ */
+enum{
+    JUNKNES_RENDER_FULL =  0,
+    JUNKNES_RENDER_OFF  = -1
+};
+JUNKNES_API void junknes_set_render_mode(struct Junknes* nes, int mode);
+
+/**
+ * 描画を別スレッドで行うか(デフォルトは無効)
+ * CPUエミュレーションと並行してラインを描画する。結果は無効時と同一
+ * で、junknes_emulate_frame() から戻った時点でスクリーンは完成している
+ */
+JUNKNES_API void junknes_set_render_thread(struct Junknes* nes, int enabled);
+
 
 struct JunknesRgb{
     uint8_t r;
@@ -82,6 +147,11 @@ struct JunknesRgb{
 };
 enum JunknesPixelFormat{
     JUNKNES_PIXEL_XRGB8888 = 0,
+    JUNKNES_PIXEL_RGBA8888 = 1, // アルファは常に0xFF
+};
+enum JunknesSampleFormat{
+    JUNKNES_SAMPLE_S16 = 0, // int16_t (native endian)
+    JUNKNES_SAMPLE_F32 = 1, // float (native endian)
 };
 struct JunknesBlit;
 struct JunknesMixer;
@@ -95,10 +165,56 @@ JUNKNES_API void junknes_blit_destroy(struct JunknesBlit* blit);
 JUNKNES_API
 void junknes_blit_do(struct JunknesBlit* blit, const uint8_t* src, void* dst, int scale);
 
-// int16_t (native endian), モノラル
+/**
+ * 描画先を登録すると、junknes_emulate_frame() で描画したラインをその場で
+ * blit の形式に変換して dst に書き込む(等倍のみ。pitch はByte単位)
+ * junknes_blit_do() による変換パスが不要になる(junknes_screen() も引き続
+ * き有効)。dst が NULL なら登録解除
+ *
+ * dst は次に登録し直すまで有効であること。ロックしたテクスチャなど、
+ * フレームごとに変わる場合は毎フレーム登録し直せばよい
+ * 描画しないフレーム(起動直後のPPUウォームアップ中、
+ * junknes_set_render_mode() によるスキップ/描画オフ)では、最後に描画し
+ * たスクリーンを変換して書き込む。dst の内容が不定でも毎フレーム全体が
+ * 書かれる
+ */
+JUNKNES_API void junknes_set_screen_target(struct Junknes* nes, const struct JunknesBlit* blit,
+                                           void* dst, int pitch);
+
+// 描画先の内容が次のフレームまで保たれる(自前のバッファなど)なら非0
+// を指定する(デフォルトは 0)。同じ dst, pitch, blit を登録している間
+// は、変化のないラインや描画しないフレームで dst に書き込まない
+// junknes_frame_unchanged() が非0なら dst も書き換わっていない
+JUNKNES_API void junknes_set_screen_target_persistent(struct Junknes* nes, int persistent);
+
+// モノラル。junknes_mixer_create() は JUNKNES_SAMPLE_S16
+// ミックスは非線形(http://wiki.nesdev.com/w/index.php/APU_Mixer)
+// SIMD化しているのは出力形式への変換と、間引きのFIR(品質1以上)のみ。
+// ミックス自体はテーブル参照をスカラーで行う(SSE2にはgatherがなく、
+// 負荷の大半は間引きなので)
 JUNKNES_API struct JunknesMixer* junknes_mixer_create(int freq, int bufsize, int fps);
+JUNKNES_API struct JunknesMixer* junknes_mixer_create_format(int freq, int bufsize, int fps,
+                                                             enum JunknesSampleFormat format);
 JUNKNES_API void junknes_mixer_destroy(struct JunknesMixer* mixer);
 
+/**
+ * 間引きの品質(デフォルトは1)
+ * 0 はフィルタなし(出力サンプルの位置の値をそのまま使う。最も軽いがエイ
+ * リアシングがある)。1 以上はCIC + ポリフェーズFIRで帯域制限してから間
+ * 引き、大きいほどフィルタが急峻でCPU負荷も高い
+ * 設定すると間引きの状態はリセットされる。再生開始前に設定すること
+ *
+ * junknes_mixer_push() の1フレームあたりのCPU時間の目安(scons bench の
+ * mixer。x86-64, -O2。エミュレーション自体は1フレーム400us程度):
+ *   品質   44100Hz   96000Hz
+ *     0       2us       3us
+ *     1      39us      54us
+ *     2      46us      70us
+ *     3      65us     107us
+ */
+enum{ JUNKNES_MIXER_QUALITY_MAX = 3 };
+JUNKNES_API void junknes_mixer_set_quality(struct JunknesMixer* mixer, int quality);
+
 JUNKNES_API void junknes_mixer_push(struct JunknesMixer* mixer, const struct JunknesSound* sound);
 
 // SDLオーディオコールバック関数としてそのまま使える
@@ -2,7 +2,7 @@
 
 from ctypes import cdll,\
                    Structure, POINTER, CFUNCTYPE,\
-                   c_int, c_uint, c_uint8, c_uint16,\
+                   c_int, c_uint, c_uint8, c_uint16, c_int16,\
                    c_void_p
 
 _lib = cdll.LoadLibrary("./libjunknes.so")
@@ -75,13 +75,36 @@ junknes_emulate_frame = _funcdef("junknes_emulate_frame", None, (POINTER(Junknes
 junknes_set_input = _funcdef("junknes_set_input", None, (POINTER(Junknes), c_int, c_uint))
 
 junknes_screen = _funcdef("junknes_screen", POINTER(c_uint8), (POINTER(Junknes),))
+junknes_ram = _funcdef("junknes_ram", POINTER(c_uint8), (POINTER(Junknes),))
 junknes_sound = _funcdef("junknes_sound", None, (POINTER(Junknes), POINTER(JunknesSound)))
+junknes_set_sample_rate = _funcdef("junknes_set_sample_rate",
+                                   None, (POINTER(Junknes), c_int))
+junknes_read_samples = _funcdef("junknes_read_samples",
+                                c_int, (POINTER(Junknes), POINTER(c_int16), c_int))
+JUNKNES_AUDIO_ON  = 0
+JUNKNES_AUDIO_OFF = 1
+
+junknes_set_audio_mode = _funcdef("junknes_set_audio_mode",
+                                  None, (POINTER(Junknes), c_int))
+junknes_frame_unchanged = _funcdef("junknes_frame_unchanged", c_int, (POINTER(Junknes),))
 
 junknes_before_exec = _funcdef("junknes_before_exec",
                                None, (POINTER(Junknes), JunknesCpuHook, c_void_p))
 
+junknes_set_sprite_limit = _funcdef("junknes_set_sprite_limit",
+                                    None, (POINTER(Junknes), c_int))
+
+JUNKNES_RENDER_FULL =  0
+JUNKNES_RENDER_OFF  = -1
+
+junknes_set_render_mode = _funcdef("junknes_set_render_mode",
+                                   None, (POINTER(Junknes), c_int))
+junknes_set_render_thread = _funcdef("junknes_set_render_thread",
+                                     None, (POINTER(Junknes), c_int))
+
 
 JUNKNES_PIXEL_XRGB8888 = 0
+JUNKNES_PIXEL_RGBA8888 = 1
 
 class JunknesRgb(Structure):
     _fields_ = (
@@ -91,6 +114,9 @@ class JunknesRgb(Structure):
         ("unused", c_uint8),
     )
 
+JUNKNES_SAMPLE_S16 = 0
+JUNKNES_SAMPLE_F32 = 1
+
 class JunknesBlit(Structure): pass
 class JunknesMixer(Structure): pass
 
@@ -99,10 +125,21 @@ junknes_blit_create = _funcdef("junknes_blit_create",
 junknes_blit_destroy = _funcdef("junknes_blit_destroy", None, (POINTER(JunknesBlit),))
 junknes_blit_do = _funcdef("junknes_blit_do",
                            None, (POINTER(JunknesBlit), POINTER(c_uint8), c_void_p, c_int))
+junknes_set_screen_target = _funcdef("junknes_set_screen_target",
+                                     None, (POINTER(Junknes), POINTER(JunknesBlit), c_void_p, c_int))
+junknes_set_screen_target_persistent = _funcdef("junknes_set_screen_target_persistent",
+                                                None, (POINTER(Junknes), c_int))
 
 junknes_mixer_create = _funcdef("junknes_mixer_create",
                                 POINTER(JunknesMixer), (c_int, c_int, c_int))
+junknes_mixer_create_format = _funcdef("junknes_mixer_create_format",
+                                       POINTER(JunknesMixer), (c_int, c_int, c_int, c_int))
 junknes_mixer_destroy = _funcdef("junknes_mixer_destroy", None, (POINTER(JunknesMixer),))
+
+JUNKNES_MIXER_QUALITY_MAX = 3
+
+junknes_mixer_set_quality = _funcdef("junknes_mixer_set_quality",
+                                     None, (POINTER(JunknesMixer), c_int))
 junknes_mixer_push = _funcdef("junknes_mixer_push",
                               None, (POINTER(JunknesMixer), POINTER(JunknesSound)))
 junknes_mixer_pull_sdl = _funcdef("junknes_mixer_pull_sdl",
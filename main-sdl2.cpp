@@ -6,8 +6,6 @@
 #include <cstdint>
 #include <cassert>
 
-#include <boost/lockfree/spsc_queue.hpp>
-
 #include <SDL.h>
 
 #include "junknes.h"
@@ -17,11 +15,6 @@
 using namespace std;
 
 namespace{
-    template<typename T>
-    bool allequal(const T& x, const T& y) { return x == y; }
-    template<typename T, typename... Args>
-    bool allequal(const T& x, const T& y, Args... tail) { return x == y && allequal(y, tail...); }
-
     struct InputMap{
         int scancode;
         int port;
@@ -152,92 +145,35 @@ namespace{
     }
 
     constexpr int FPS = 60;
-    boost::lockfree::spsc_queue<
-        int16_t,
-        boost::lockfree::capacity<16*(AUDIO_FREQ/FPS)> // とりあえず多めで
-    > audio_queue;
-
-    void audio_pull(void* /*userdata*/, uint8_t* stream, int len)
-    {
-        assert(!(len&1));
-        //INFO("%d\n", len);
-
-        unsigned int n_sample = len / 2;
-
-        int16_t* p = reinterpret_cast<int16_t*>(stream);
-        size_t n_pop = audio_queue.pop(p, n_sample);
-        if(n_pop < n_sample){
-            INFO("UNDERFLOW: %lu samples\n", n_sample - n_pop);
-            fill_n(p+n_pop, n_sample-n_pop, 0);
-        }
-    }
 
-    void audio_push(const JunknesSound& sound)
+    JunknesBlit* create_blit()
     {
-        assert(allequal(sound.sq1.len,
-                        sound.sq2.len,
-                        sound.tri.len,
-                        sound.noi.len,
-                        sound.dmc.len));
-        int len = sound.sq1.len;
-
-        // CPU周波数とサンプリング周波数が異なるので、1F内では全ての
-        // データを処理できず余りが出る。offset 変数でそのズレを管理
-        static int offset = 0;
-
-        //constexpr int16_t MUL = 1000;
-        constexpr double CPU_FREQ = 6.0 * 39375000.0/11.0 / 12.0;
-        constexpr double STEP = CPU_FREQ / AUDIO_FREQ;
-
-        int n_sample = static_cast<int>((len-offset) / STEP);
-        //INFO("%d\n", n_sample);
-        // TODO: 1ステップ未満の場合の offset 補正
-        if(n_sample <= 0) return;
-
-        double pos = offset;
-        int n_written = 0;
-        while(n_written < n_sample){
-            int pos_int = static_cast<int>(pos);
-            uint8_t v_sq1 = sound.sq1.data[pos_int]; // [0, 15]
-            uint8_t v_sq2 = sound.sq2.data[pos_int]; // [0, 15]
-            uint8_t v_tri = sound.tri.data[pos_int]; // [0, 15]
-            uint8_t v_noi = sound.noi.data[pos_int]; // [0, 15]
-            uint8_t v_dmc = sound.dmc.data[pos_int]; // [0,127]
-
-            // http://wiki.nesdev.com/w/index.php/APU_Mixer
-            double mixed = 0.00752*(v_sq1+v_sq2) + 0.00851*v_tri + 0.00494*v_noi + 0.00335*v_dmc;
-            int16_t sample = 20000 * (mixed-0.5);
-
-            if(audio_queue.push(sample)){
-                ++n_written;
-                pos += STEP;
-            }
-            else{
-                INFO("OVERFLOW: %lu samples\n", n_sample - n_written);
-                break;
-            }
+        JunknesRgb palette[0x40];
+        for(int i = 0; i < 0x40; ++i){
+            palette[i].r = PALETTE_RGBA[i] >> 24;
+            palette[i].g = PALETTE_RGBA[i] >> 16;
+            palette[i].b = PALETTE_RGBA[i] >>  8;
+            palette[i].unused = 0;
         }
 
-        if(n_written == n_sample){
-            offset = static_cast<int>(STEP - (len-pos));
-        }
-        else{
-            // キューがオーバーフローしたらデータを捨てるので offset もリセット
-            offset = 0;
-        }
-        //INFO("%d\n", offset);
+        JunknesBlit* blit = junknes_blit_create(palette, JUNKNES_PIXEL_RGBA8888);
+        if(!blit) error("junknes_blit_create() failed");
+        return blit;
     }
 
-    void draw(SDL_Texture* tex, const uint8_t* screen)
+    // テクスチャをロックして描画先として登録してから1フレーム進める
+    // (コアがラインごとに直接書き込む)
+    void emulate_frame(Junknes* nes, JunknesBlit* blit, SDL_Texture* tex)
     {
-        uint32_t* p = nullptr;
+        void* p = nullptr;
         int pitch = -1;
-        if(SDL_LockTexture(tex, nullptr, reinterpret_cast<void**>(&p), &pitch) < 0)
+        if(SDL_LockTexture(tex, nullptr, &p, &pitch) < 0)
             error("SDL_LockTexture() failed");
-        assert(pitch == sizeof(p[0]) * 256);
+        assert(pitch >= static_cast<int>(sizeof(uint32_t)) * 256);
 
-        for(int i = 0; i < 256*240; ++i)
-            *p++ = PALETTE_RGBA[screen[i]];
+        junknes_set_screen_target(nes, blit, p, pitch);
+        junknes_emulate_frame(nes);
+        junknes_set_screen_target(nes, nullptr, nullptr, 0);
 
         SDL_UnlockTexture(tex);
     }
@@ -459,6 +395,9 @@ int main(int argc, char** argv)
     }
 
 
+    JunknesMixer* mixer = junknes_mixer_create(AUDIO_FREQ, AUDIO_SAMPLES, FPS);
+    if(!mixer) error("junknes_mixer_create() failed");
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wmissing-field-initializers"
     SDL_AudioSpec want = {};
@@ -467,7 +406,8 @@ int main(int argc, char** argv)
     want.format   = AUDIO_FORMAT;
     want.channels = AUDIO_CHANNELS;
     want.samples  = AUDIO_SAMPLES;
-    want.callback = audio_pull;
+    want.callback = junknes_mixer_pull_sdl;
+    want.userdata = mixer;
     puts("[Desired audio spec]");
     print_audio_spec(want, false);
     puts("");
@@ -515,6 +455,7 @@ int main(int argc, char** argv)
     Junknes* nes = junknes_create(prg.data(), chr.data(), mirror);
     if(!nes) error("junknes_create() failed");
     if(dbg) junknes_before_exec(nes, trace_one, nullptr);
+    JunknesBlit* blit = create_blit();
 
     SDL_PauseAudioDevice(audio, 0);
 
@@ -534,13 +475,11 @@ int main(int argc, char** argv)
         junknes_set_input(nes, 0, inputs[0]);
         junknes_set_input(nes, 1, inputs[1]);
 
-        junknes_emulate_frame(nes);
+        emulate_frame(nes, blit, tex);
 
         JunknesSound sound;
         junknes_sound(nes, &sound);
-        audio_push(sound);
-
-        draw(tex, junknes_screen(nes));
+        junknes_mixer_push(mixer, &sound);
 
         //SDL_RenderClear(ren);
         SDL_RenderCopy(ren, tex, nullptr, nullptr);
@@ -558,6 +497,7 @@ int main(int argc, char** argv)
         }
     }
 
+    junknes_blit_destroy(blit);
     junknes_destroy(nes);
 
     SDL_DestroyTexture(tex);
@@ -565,6 +505,7 @@ int main(int argc, char** argv)
     SDL_DestroyWindow(win);
 
     SDL_CloseAudioDevice(audio);
+    junknes_mixer_destroy(mixer);
 
     return 0;
 }
@@ -5,6 +5,7 @@
 #include <cstdio>
 #include <cstdint>
 #include <cassert>
+#include <climits>
 
 #include "junknes.h"
 #include "nes.hpp"
@@ -13,6 +14,11 @@
 #include "apu.hpp"
 #include "util.hpp"
 
+#ifdef JUNKNES_STATIC_BUS
+#   include "cpu-impl.hpp"
+#   include "ppu-impl.hpp"
+#endif
+
 using namespace std;
 
 namespace{
@@ -30,106 +36,142 @@ Nes::Nes(const uint8_t* prg, const uint8_t* chr, JunknesMirroring mirror)
     : prg_(my_make_array<0x8000>(prg)), chr_(my_make_array<0x2000>(chr)), mirror_(mirror),
       cpu_(make_shared<CpuDoor>(*this)),
       ppu_(make_shared<PpuDoor>(*this)),
-      apu_(make_shared<ApuDoor>(*this))
+      renderPpu_(make_shared<RenderDoor>(*this)),
+      apu_(make_shared<ApuDoor>(*this)),
+      renderMode_(JUNKNES_RENDER_FULL), skipCount_(0), renderFrame_(true),
+      target_(nullptr), targetPitch_(0),
+      targetLast_(nullptr), targetPersistent_(false), targetValid_(false),
+      renderPublished_(0), renderDone_(0), renderSleeping_(false), renderQuit_(false),
+      renderHead_(0),
+      vramSnapCount_(0), oamSnapCount_(0),
+      vramWrites_(0), oamWrites_(0), vramWritesSnap_(0), oamWritesSnap_(0),
+      renderVram_(nullptr),
+      lineHashAge_(0),
+      vramHash_(0), oamHash_(0), vramWritesHash_(~0u), oamWritesHash_(~0u),
+      frameUnchanged_(false)
 {
     initRW();
     initRWPpu();
 
+    cpu_.predecode(prg_.data());
+    ppu_.decodeChr(chr_.data());
+
     hardReset();
 }
 
+Nes::~Nes()
+{
+    setRenderThread(false);
+}
+
+namespace{
+    uint16_t vram_addr_horiz(uint16_t addr)
+    {
+        uint16_t hi = (addr & 0x800) >> 1;
+        uint16_t lo = addr & 0x3FF;
+        return hi | lo;
+    }
+
+    uint16_t vram_addr_vert(uint16_t addr)
+    {
+        uint16_t hi = addr & 0x400;
+        uint16_t lo = addr & 0x3FF;
+        return hi | lo;
+    }
+}
+
 void Nes::initRW()
 {
-    // $0000-$07FF
-    fill_n(readers_.begin(), 0x800, &Nes::readRam);
-    fill_n(writers_.begin(), 0x800, &Nes::writeRam);
-
-    // $0800-$1FFF
-    fill_n(readers_.begin()+0x800, 3*0x800, &Nes::readRamMirror);
-    fill_n(writers_.begin()+0x800, 3*0x800, &Nes::writeRamMirror);
-
-    // $2000-$3FFF
-    for(uint16_t addr = 0x2000; addr < 0x4000; addr += 8){
-        readers_[addr+0] = &Nes::read200x;
-        readers_[addr+1] = &Nes::read200x;
-        readers_[addr+2] = &Nes::read2002;
-        readers_[addr+3] = &Nes::read200x;
-        readers_[addr+4] = &Nes::read2004;
-        readers_[addr+5] = &Nes::read200x;
-        readers_[addr+6] = &Nes::read200x;
-        readers_[addr+7] = &Nes::read2007;
-
-        writers_[addr+0] = &Nes::write2000;
-        writers_[addr+1] = &Nes::write2001;
-        writers_[addr+2] = &Nes::write2002;
-        writers_[addr+3] = &Nes::write2003;
-        writers_[addr+4] = &Nes::write2004;
-        writers_[addr+5] = &Nes::write2005;
-        writers_[addr+6] = &Nes::write2006;
-        writers_[addr+7] = &Nes::write2007;
-    }
-
-    // $4000-$4017
-    fill_n(readers_.begin()+0x4000, 0x15, &Nes::readNull);
-    readers_[0x4015] = &Nes::read4015;
-    readers_[0x4016] = &Nes::read4016;
-    readers_[0x4017] = &Nes::read4017;
-
-    writers_[0x4000] = &Nes::write4000;
-    writers_[0x4001] = &Nes::write4001;
-    writers_[0x4002] = &Nes::write4002;
-    writers_[0x4003] = &Nes::write4003;
-    writers_[0x4004] = &Nes::write4004;
-    writers_[0x4005] = &Nes::write4005;
-    writers_[0x4006] = &Nes::write4006;
-    writers_[0x4007] = &Nes::write4007;
-    writers_[0x4008] = &Nes::write4008;
-    writers_[0x4009] = &Nes::writeNull;
-    writers_[0x400A] = &Nes::write400A;
-    writers_[0x400B] = &Nes::write400B;
-    writers_[0x400C] = &Nes::write400C;
-    writers_[0x400D] = &Nes::writeNull;
-    writers_[0x400E] = &Nes::write400E;
-    writers_[0x400F] = &Nes::write400F;
-    writers_[0x4010] = &Nes::write4010;
-    writers_[0x4011] = &Nes::write4011;
-    writers_[0x4012] = &Nes::write4012;
-    writers_[0x4013] = &Nes::write4013;
-    writers_[0x4014] = &Nes::write4014;
-    writers_[0x4015] = &Nes::write4015;
-    writers_[0x4016] = &Nes::write4016;
-    writers_[0x4017] = &Nes::write4017;
-
-    // $4018-$7FFF
-    fill_n(readers_.begin()+0x4018, 0x8000-0x4018, &Nes::readNull);
-    fill_n(writers_.begin()+0x4018, 0x8000-0x4018, &Nes::writeNull);
+    pageNull_.fill(0);
+
+    // $0000-$1FFF ($0800-$1FFF はミラー)
+    for(int page = 0x00; page < 0x20; ++page){
+        readPages_[page]  = ram_.data() + ((page&7) << 8);
+        writePages_[page] = ram_.data() + ((page&7) << 8);
+    }
+
+    // $2000-$40FF (I/O)
+    fill(readPages_.begin()+0x20, readPages_.begin()+0x41, nullptr);
+    fill(writePages_.begin()+0x20, writePages_.begin()+0x41, nullptr);
+
+    // $4100-$7FFF
+    fill(readPages_.begin()+0x41, readPages_.begin()+0x80, pageNull_.data());
+    fill(writePages_.begin()+0x41, writePages_.begin()+0x80, pageSink_.data());
 
     // $8000-$FFFF
-    fill_n(readers_.begin()+0x8000, 0x8000, &Nes::readPrg);
-    fill_n(writers_.begin()+0x8000, 0x8000, &Nes::writeNull);
+    for(int page = 0x80; page < 0x100; ++page){
+        readPages_[page]  = prg_.data() + ((page-0x80) << 8);
+        writePages_[page] = pageSink_.data();
+    }
+
+    // $2000-$3FFF (8Byte単位でミラー)
+    readers2000_ = {{
+        &Nes::read200x, &Nes::read200x, &Nes::read2002, &Nes::read200x,
+        &Nes::read2004, &Nes::read200x, &Nes::read200x, &Nes::read2007
+    }};
+    writers2000_ = {{
+        &Nes::write2000, &Nes::write2001, &Nes::write2002, &Nes::write2003,
+        &Nes::write2004, &Nes::write2005, &Nes::write2006, &Nes::write2007
+    }};
+
+    // $4000-$401F
+    readers4000_.fill(&Nes::readNull);
+    readers4000_[0x15] = &Nes::read4015;
+    readers4000_[0x16] = &Nes::read4016;
+    readers4000_[0x17] = &Nes::read4017;
+
+    writers4000_ = {{
+        &Nes::write4000, &Nes::write4001, &Nes::write4002, &Nes::write4003,
+        &Nes::write4004, &Nes::write4005, &Nes::write4006, &Nes::write4007,
+        &Nes::write4008, &Nes::writeNull, &Nes::write400A, &Nes::write400B,
+        &Nes::write400C, &Nes::writeNull, &Nes::write400E, &Nes::write400F,
+        &Nes::write4010, &Nes::write4011, &Nes::write4012, &Nes::write4013,
+        &Nes::write4014, &Nes::write4015, &Nes::write4016, &Nes::write4017,
+        &Nes::writeNull, &Nes::writeNull, &Nes::writeNull, &Nes::writeNull,
+        &Nes::writeNull, &Nes::writeNull, &Nes::writeNull, &Nes::writeNull
+    }};
 }
 
 void Nes::initRWPpu()
 {
     // $0000-$1FFF
-    fill_n(readersPpu_.begin(), 0x2000, &Nes::readPpuChr);
-    fill_n(writersPpu_.begin(), 0x2000, &Nes::writeNull);
+    for(int page = 0x00; page < 0x20; ++page){
+        readPagesPpu_[page]  = chr_.data() + (page << 8);
+        writePagesPpu_[page] = pageSink_.data();
+    }
 
     // $2000-$3EFF
-    fill_n(readersPpu_.begin()+0x2000, 0x1F00,
-           mirror_ == JUNKNES_MIRROR_H ? &Nes::readPpuVramH : &Nes::readPpuVramV);
-    fill_n(writersPpu_.begin()+0x2000, 0x1F00,
-           mirror_ == JUNKNES_MIRROR_H ? &Nes::writePpuVramH : &Nes::writePpuVramV);
+    for(int page = 0x20; page < 0x3F; ++page){
+        uint16_t addr = page << 8;
+        uint16_t offset = mirror_ == JUNKNES_MIRROR_H ? vram_addr_horiz(addr) : vram_addr_vert(addr);
+        readPagesPpu_[page]  = vram_.data() + offset;
+        writePagesPpu_[page] = vram_.data() + offset;
+    }
+
+    // $3F00-$3FFF (パレットはPPU側で処理)
+    readPagesPpu_[0x3F]  = nullptr;
+    writePagesPpu_[0x3F] = nullptr;
 
-    // $3F00-$3FFF
-    fill_n(readersPpu_.begin()+0x3F00, 0x100, &Nes::readPpuPltram);
-    fill_n(writersPpu_.begin()+0x3F00, 0x100, &Nes::writePpuPltram);
+    ppu_.mapNametables(nametables(vram_.data()));
+}
+
+// vram (2KB) を実体とする4つの論理ネームテーブル
+array<const uint8_t*, 4> Nes::nametables(const uint8_t* vram) const
+{
+    array<const uint8_t*, 4> nt;
+    for(int i = 0; i < 4; ++i){
+        uint16_t addr = 0x2000 + 0x400*i;
+        nt[i] = vram + (mirror_ == JUNKNES_MIRROR_H ? vram_addr_horiz(addr) : vram_addr_vert(addr));
+    }
+    return nt;
 }
 
 void Nes::hardReset()
 {
     ram_.fill(0);
     vram_.fill(0);
+    ++vramWrites_;
+    ++oamWrites_; // ppu_.hardReset() でクリアされる
 
     cpu_.hardReset();
     ppu_.hardReset();
@@ -137,12 +179,20 @@ void Nes::hardReset()
 
     ppuWarmup_ = 2;
     oddFrame_ = false;
+    eventSeq_ = 0;
+    nextLine_ = 241;
+    catchUpTime_ = INT_MAX;
+
+    sideEffects_ = 0;
+    last2002_ = 0x100;
 
     input_.fill(0);
     inputBit_.fill(0);
     inputStrobe_ = false;
 
     screen_.fill(0);
+    lineHash_.fill(0);
+    targetValid_ = false;
 }
 
 void Nes::softReset()
@@ -153,12 +203,20 @@ void Nes::softReset()
 
     ppuWarmup_ = 2;
     oddFrame_ = false;
+    eventSeq_ = 0;
+    nextLine_ = 241;
+    catchUpTime_ = INT_MAX;
+
+    sideEffects_ = 0;
+    last2002_ = 0x100;
 
     input_.fill(0);
     inputBit_.fill(0);
     inputStrobe_ = false;
 
     screen_.fill(0);
+    lineHash_.fill(0);
+    targetValid_ = false;
 }
 
 // port の値域チェックはライブラリインターフェース側で行う
@@ -167,81 +225,399 @@ void Nes::setInput(int port, unsigned int value)
     input_[port] = value;
 }
 
-// ライン単位でエミュレート
+namespace{
+    // lineHash_ を全て無効にして描画し直す間隔(描画したフレーム数)
+    constexpr int LINE_HASH_REFRESH_FRAMES = 64;
+}
+
+// イベント駆動でエミュレート
 // タイミングは全てFCEUXと同じ。line 240 (post-render) がフレーム境界
 void Nes::emulateFrame()
 {
-    if(ppuWarmup_){
-        apu_.startFrame();
-        cpu_.exec(341 * 262);
-        apu_.endFrame();
-        --ppuWarmup_;
-        return;
+    if(renderMode_ == JUNKNES_RENDER_FULL){
+        renderFrame_ = true;
+    }
+    else if(renderMode_ == JUNKNES_RENDER_OFF){
+        renderFrame_ = false;
+    }
+    else{
+        renderFrame_ = skipCount_ >= renderMode_;
+        skipCount_ = renderFrame_ ? 0 : skipCount_+1;
+    }
+
+    frameUnchanged_ = true;
+    vramSnapCount_ = oamSnapCount_ = 0;
+
+    // ウォームアップ中は processLine() が呼ばれない
+    bool drawn = renderFrame_ && !ppuWarmup_;
+
+    // ハッシュの衝突で古いラインが残り続けないよう、定期的に全て描画する
+    if(drawn && ++lineHashAge_ >= LINE_HASH_REFRESH_FRAMES){
+        lineHash_.fill(0);
+        lineHashAge_ = 0;
     }
 
     apu_.startFrame();
 
-    // line 240 (post-render)
-    cpu_.exec(341);
+    frameTime_ = sliceEnd_ = 0;
+    if(ppuWarmup_)
+        schedule(341 * 262, &Nes::eventWarmupEnd);
+    else
+        schedule(341, &Nes::eventVBlank);
+    runEvents();
+
+    cpu_.syncApu();
+    apu_.endFrame();
+
+    if(renderThread_.joinable()) waitRender();
+
+    // 描画しなかったフレームでは描画先にラインが書かれていないので、最後
+    // に描画したスクリーンを変換しておく(ロックしたテクスチャなどは内容
+    // が不定)。内容が保たれていて一致しているなら不要
+    if(!drawn && !targetValid_){
+        for(int line = 0; line < 240; ++line)
+            convertLine(line, screen_.data() + 256*line);
+    }
+
+    // 描画先があれば、このフレームで全ラインが screen_ と一致した
+    targetValid_ = target_ && targetPersistent_;
+}
+
+// CPU実行中(バスアクセスのハンドラ内)に現スライスより前のイベントを登
+// 録した場合、CPUをそこで止める
+void Nes::schedule(int time, EventHandler handler, int arg)
+{
+    assert(frameTime_ <= time);
+    if(time < sliceEnd_){
+        cpu_.cutSlice(sliceEnd_ - time);
+        sliceEnd_ = time;
+    }
+    events_.push(Event{ time, eventSeq_++, handler, arg });
+}
+
+// キューが空になるまでイベントを処理する(空になったらフレーム終了)
+void Nes::runEvents()
+{
+    while(!events_.empty()){
+        const Event& top = events_.top();
+        if(frameTime_ < top.time){
+            // 実行中により早いイベントが登録されうるので、戻ったら先頭を
+            // 見直す
+            sliceEnd_ = top.time;
+            cpu_.exec(top.time - frameTime_);
+            frameTime_ = sliceEnd_;
+            continue;
+        }
+
+        Event ev = top;
+        events_.pop();
+        (this->*ev.handler)(ev.arg);
+    }
+
+    eventSeq_ = 0;
+}
+
+void Nes::eventWarmupEnd(int)
+{
+    --ppuWarmup_;
+}
 
-    // line 241
+// line 241
+void Nes::eventVBlank(int)
+{
     ppu_.setVBlank(true);
     ppu_.resetOamAddr(); // PPU[3] = PPUSPL = 0
-    cpu_.exec(12);
-    if(ppu_.nmiEnabled()) triggerNmi();
-    cpu_.exec(329);
+    schedule(frameTime_ + 12, &Nes::eventNmi);
+}
 
-    // line 242-260
-    cpu_.exec(341 * 19);
+void Nes::eventNmi(int)
+{
+    if(ppu_.nmiEnabled()) triggerNmi();
+    schedule(341 * 21, &Nes::eventPreRender); // line 242-260 はイベントなし
+}
 
-    // line 261 (pre-render)
+// line 261 (pre-render)
+void Nes::eventPreRender(int)
+{
     ppu_.setSprOver(false);
     ppu_.setSpr0Hit(false);
     ppu_.setVBlank(false);
-    cpu_.exec(325);
+    schedule(frameTime_ + 325, &Nes::eventReloadAddr);
+}
+
+void Nes::eventReloadAddr(int)
+{
     ppu_.reloadAddr(); // if(isRenderingOn()) v = t
     // TODO: ここで以下のコード実行
     //   spork = numsprites = 0;
     //   ResetRL(XBuf);
-    cpu_.exec(oddFrame_ ? 15 : 16);
+    lineBase_ = frameTime_ + (oddFrame_ ? 15 : 16);
+    nextLine_ = 0;
     oddFrame_ ^= 1;
 
-    // line 0-239
-    // TODO: ここでframeskip時にspr_overを1にしてるが…
-    for(int line = 0; line < 240; ++line){
-        // TODO: FCEUXの DoLine() と同じにする
-        
-#if 1
-        ppu_.startLine();
-        ppu_.doLine(line, screen_.data() + 256*line);
-        cpu_.exec(341);
-        ppu_.endLine();
-#endif
+    schedule(lineTime(240), &Nes::eventFrameEnd);
+    scheduleCatchUp();
+}
+
+/**
+ * 遅延描画
+ *
+ * 各ラインの処理(以前はラインごとのイベント)は、その時刻を過ぎてから
+ * PPUレジスタ($2000-$2007, $4014)がアクセスされた時点か、フレーム終了
+ * 時にまとめて行う。PPUの状態はこれらのアクセスでしか変わらないので結
+ * 果は同じになる
+ *
+ * ただしスプライト0ヒットはCPUから読めるので、起こるラインの時刻には
+ * イベントを置いてCPUを止める(空ループの早送りがそこを越えないように)
+ * 描画スレッドの使用時は RENDER_HANDOFF_LINES ごとにもイベントを置き、
+ * 描画をCPUの実行と並行させる
+ */
+int Nes::lineTime(int line) const
+{
+    return lineBase_ + 341*line;
+}
+
+// 時刻 time までに開始するラインを処理する
+void Nes::catchUp(int time)
+{
+    while(nextLine_ <= 240 && lineTime(nextLine_) <= time)
+        processLine(nextLine_++);
+}
+
+// PPUレジスタのアクセス時
+// 命令は開始時点で残りサイクルが3以上あればライン境界の前に実行されて
+// いたので、それに合わせる
+// 書き込みの場合は処理後に scheduleCatchUp() で予測を見直すこと
+void Nes::catchUpAccess()
+{
+    if(nextLine_ > 240) return;
+
+    catchUp(sliceEnd_ - cpu_.restCycleAtOp() + 2);
+}
+
+namespace{
+    // 描画スレッドの使用時に、PPUアクセスがなくてもラインを渡す間隔
+    constexpr int RENDER_HANDOFF_LINES = 8;
+}
+
+// 次に処理すべきラインの時刻に eventCatchUp を置く
+// 描画スレッドの使用時は、フレーム終了時にまとめて記録すると描画が並行
+// せず waitRender() で待つだけになるので、一定ラインごとにも置く
+void Nes::scheduleCatchUp()
+{
+    int line = ppu_.nextSpr0Line(nextLine_);
+    if(renderThread_.joinable() && renderFrame_ && nextLine_ < 240){
+        int handoff = min(nextLine_ + RENDER_HANDOFF_LINES, 239);
+        if(line < 0 || handoff < line) line = handoff;
     }
+    if(line < 0) return;
 
-    apu_.endFrame();
+    int time = lineTime(line);
+    if(time >= catchUpTime_) return; // それより前に見直される
 
-#if 0
-    ppu_.startFrame();
-    apu_.startFrame();
+    catchUpTime_ = time;
+    schedule(time, &Nes::eventCatchUp);
+}
+
+void Nes::eventCatchUp(int)
+{
+    catchUpTime_ = INT_MAX;
+    catchUp(frameTime_);
+    scheduleCatchUp();
+}
+
+void Nes::eventFrameEnd(int)
+{
+    catchUp(frameTime_);
+}
+
+// line 0-239 の開始(および前ラインの終了)。line == 240 でフレーム終了
+// TODO: ここでframeskip時にspr_overを1にしてるが…
+void Nes::processLine(int line)
+{
+    if(line > 0) ppu_.endLine();
+    if(line == 240) return;
 
-    // line 0-239
-    for(int line = 0; line < 240; ++line){
-        ppu_.startLine();
-        ppu_.doLine(line, screen_.data() + 256*line);
-        cpu_.exec(341);
-        ppu_.endLine();
+    // TODO: FCEUXの DoLine() と同じにする
+    ppu_.startLine();
+    if(!renderFrame_){
+        ppu_.skipLine(line);
+        return;
     }
 
-    // line 240-261 (post-render, VBLANK, pre-render)
-    for(int line = 240; line < 262; ++line){
-        if(line == 241)
-            ppu_.startVBlank();
-        cpu_.exec(341);
+    // 入力が screen_ のこのラインを描画した時と同じなら描画しない
+    uint8_t* buf = screen_.data() + 256*line;
+    uint64_t hash = lineInputHash();
+    if(hash == lineHash_[line]){
+        ppu_.skipLine(line);
+        if(!targetValid_) convertLine(line, buf);
+        return;
     }
+    lineHash_[line] = hash;
+    frameUnchanged_ = false;
 
-    apu_.endFrame();
-#endif
+    if(renderThread_.joinable()){
+        recordLine(line);
+        ppu_.skipLine(line);
+    }
+    else{
+        ppu_.doLine(line, buf);
+        convertLine(line, buf);
+    }
+}
+
+namespace{
+    // FNV-1a (64bit)
+    uint64_t fnv1a(const uint8_t* p, size_t n, uint64_t h=UINT64_C(0xCBF29CE484222325))
+    {
+        for(size_t i = 0; i < n; ++i){
+            h ^= p[i];
+            h *= UINT64_C(0x100000001B3);
+        }
+        return h;
+    }
+}
+
+/**
+ * 現在のラインの描画に影響する入力(レジスタ、パレット、VRAM、OAM)の
+ * ハッシュ。0 にはならない(lineHash_ の無効値)
+ * VRAM/OAMのハッシュは書き込みがあった場合のみ計算し直す
+ */
+uint64_t Nes::lineInputHash()
+{
+    if(vramWrites_ != vramWritesHash_){
+        vramHash_ = fnv1a(vram_.data(), vram_.size());
+        vramWritesHash_ = vramWrites_;
+    }
+    if(oamWrites_ != oamWritesHash_){
+        oamHash_ = fnv1a(ppu_.oam(), 0x100);
+        oamWritesHash_ = oamWrites_;
+    }
+
+    PpuRenderState st;
+    ppu_.saveRenderState(st);
+    const uint8_t regs[] = {
+        st.ctrl, st.mask, uint8_t(st.regV), uint8_t(st.regV>>8), st.regX
+    };
+
+    uint64_t h = fnv1a(regs, sizeof(regs), vramHash_ ^ (oamHash_ * 31));
+    h = fnv1a(st.pltram.data(), st.pltram.size(), h);
+    return h | 1;
+}
+
+// 直前に書いたラインなのでキャッシュに乗っているうちに変換する
+void Nes::convertLine(int line, const uint8_t* buf)
+{
+    if(!target_) return;
+
+    uint32_t* dst = reinterpret_cast<uint32_t*>(target_ + targetPitch_*line);
+    for(int x = 0; x < 256; ++x)
+        dst[x] = targetPalette_[buf[x]];
+}
+
+void Nes::setRenderThread(bool enabled)
+{
+    if(enabled == renderThread_.joinable()) return;
+
+    if(enabled){
+        vramSnaps_.resize(240);
+        oamSnaps_.resize(240);
+        renderPpu_.hardReset();
+        renderPpu_.decodeChr(chr_.data());
+        renderQuit_ = false;
+        // 開始位置はここで渡す(スレッドが動き出す前に記録が進みうる)
+        renderThread_ = thread(&Nes::renderWorker, this, renderHead_, renderDone_.load());
+    }
+    else{
+        {
+            lock_guard<mutex> lock(renderMutex_);
+            renderQuit_ = true;
+            renderCond_.notify_one();
+        }
+        renderThread_.join();
+    }
+}
+
+// CPUスレッド: line の描画に必要な状態を記録して描画スレッドへ渡す
+void Nes::recordLine(int line)
+{
+    // 変化のないラインは記録されないので、ライン番号ではなく記録順に格
+    // 納する(1フレーム分を超えて溜まることはない)
+    // 2^32 は240の倍数ではないので、スロットは通し番号とは別に持つ
+    RenderLine& rl = renderLines_[renderHead_];
+    renderHead_ = (renderHead_+1) % 240;
+    rl.line = line;
+    ppu_.saveRenderState(rl.state);
+
+    // フレーム内で最初に記録するラインでは必ずスナップショットを取る
+    // (スナップショットは emulateFrame() の先頭で空にする)
+    if(vramSnapCount_ == 0 || vramWrites_ != vramWritesSnap_){
+        vramSnaps_[vramSnapCount_] = vram_;
+        rl.vram = vramSnaps_[vramSnapCount_++].data();
+        vramWritesSnap_ = vramWrites_;
+    }
+    else{
+        rl.vram = vramSnaps_[vramSnapCount_-1].data();
+    }
+
+    if(oamSnapCount_ == 0 || oamWrites_ != oamWritesSnap_){
+        copy(ppu_.oam(), ppu_.oam()+0x100, oamSnaps_[oamSnapCount_].begin());
+        rl.oam = oamSnaps_[oamSnapCount_++].data();
+        oamWritesSnap_ = oamWrites_;
+    }
+    else{
+        rl.oam = nullptr;
+    }
+
+    ++renderPublished_;
+    if(renderSleeping_){
+        lock_guard<mutex> lock(renderMutex_);
+        renderCond_.notify_one();
+    }
+}
+
+// 描画スレッド本体
+// tail, done: 起動時の記録位置と描画済みライン数(記録済みのラインは全
+// て描画済み)
+void Nes::renderWorker(int tail, unsigned int done)
+{
+    for(;;){
+        // 次のラインを待つ。しばらく来なければ眠る
+        for(int spin = 0; renderPublished_ == done; ++spin){
+            if(renderQuit_) return;
+            if(spin < 1000){
+                this_thread::yield();
+                continue;
+            }
+            unique_lock<mutex> lock(renderMutex_);
+            renderSleeping_ = true;
+            renderCond_.wait(lock, [&]{ return renderPublished_ != done || renderQuit_; });
+            renderSleeping_ = false;
+        }
+
+        const RenderLine& rl = renderLines_[tail];
+        tail = (tail+1) % 240;
+        if(rl.vram != renderVram_){
+            renderVram_ = rl.vram;
+            renderPpu_.mapNametables(nametables(renderVram_));
+        }
+        if(rl.oam) renderPpu_.oamDma(rl.oam);
+        renderPpu_.loadRenderState(rl.state);
+
+        uint8_t* buf = screen_.data() + 256*rl.line;
+        renderPpu_.doLine(rl.line, buf);
+        convertLine(rl.line, buf);
+
+        renderDone_ = ++done;
+    }
+}
+
+// CPUスレッド: 記録済みのラインが全て描画されるまで待つ
+void Nes::waitRender()
+{
+    unsigned int published = renderPublished_;
+    while(renderDone_ != published)
+        this_thread::yield();
 }
 
 const uint8_t* Nes::screen() const
@@ -249,6 +625,32 @@ const uint8_t* Nes::screen() const
     return screen_.data();
 }
 
+const uint8_t* Nes::ram() const
+{
+    return ram_.data();
+}
+
+void Nes::setScreenTarget(const uint32_t* palette, void* dst, int pitch)
+{
+    target_ = static_cast<uint8_t*>(dst);
+    if(!target_) return;
+
+    // 前回と同じ描画先、パレットなら内容はそのまま使える
+    bool same = target_ == targetLast_ && pitch == targetPitch_ &&
+        (!palette || equal(palette, palette+0x40, targetPalette_.begin()));
+    if(!same) targetValid_ = false;
+
+    targetLast_ = target_;
+    targetPitch_ = pitch;
+    if(palette) copy(palette, palette+0x40, targetPalette_.begin());
+}
+
+void Nes::setScreenTargetPersistent(bool persistent)
+{
+    targetPersistent_ = persistent;
+    targetValid_ = false;
+}
+
 JunknesSound Nes::sound() const
 {
     return JunknesSound{
@@ -260,80 +662,148 @@ JunknesSound Nes::sound() const
     };
 }
 
+void Nes::setSampleRate(int freq)
+{
+    apu_.setSampleRate(freq);
+}
+
+int Nes::readSamples(int16_t* buf, int max)
+{
+    return apu_.readSamples(buf, max);
+}
+
+void Nes::setSoundOff(bool off)
+{
+    apu_.setSoundOff(off);
+}
+
 void Nes::beforeExec(JunknesCpuHook hook, void* userdata)
 {
     cpu_.beforeExec(hook, userdata);
 }
 
+void Nes::setSpriteLimit(bool enabled)
+{
+    ppu_.setSpriteLimit(enabled);
+    renderPpu_.setSpriteLimit(enabled);
+    lineHash_.fill(0);
+}
+
+bool Nes::frameUnchanged() const
+{
+    return frameUnchanged_;
+}
+
+void Nes::setRenderMode(int mode)
+{
+    renderMode_ = mode;
+    skipCount_ = 0;
+}
+
 
 void Nes::triggerNmi() { cpu_.triggerNmi(); }
 void Nes::triggerIrq() { cpu_.triggerIrq(); }
 
 uint8_t Nes::read(uint16_t addr)
 {
-    return (this->*readers_[addr])(addr);
+    const uint8_t* page = readPages_[addr >> 8];
+    if(page) return page[addr & 0xFF];
+    return readIo(addr);
 }
 
 void Nes::write(uint16_t addr, uint8_t value)
 {
-    (this->*writers_[addr])(addr, value);
+    ++sideEffects_;
+    last2002_ = 0x100;
+
+    uint8_t* page = writePages_[addr >> 8];
+    if(page)
+        page[addr & 0xFF] = value;
+    else
+        writeIo(addr, value);
 }
 
 uint8_t Nes::readPpu(uint16_t addr)
 {
-    return (this->*readersPpu_[addr])(addr);
+    const uint8_t* page = readPagesPpu_[addr >> 8];
+    if(page) return page[addr & 0xFF];
+    return ppu_.readPltram(addr);
 }
 
 void Nes::writePpu(uint16_t addr, uint8_t value)
 {
-    (this->*writersPpu_[addr])(addr, value);
+    ++vramWrites_;
+    uint8_t* page = writePagesPpu_[addr >> 8];
+    if(page)
+        page[addr & 0xFF] = value;
+    else
+        ppu_.writePltram(addr, value);
 }
 
-
-uint8_t Nes::readNull(uint16_t) { return 0; }
-void Nes::writeNull(uint16_t, uint8_t) {}
-
-uint8_t Nes::readRam(uint16_t addr)
+// $2000-$40FF
+uint8_t Nes::readIo(uint16_t addr)
 {
-    return ram_[addr];
+    if(addr < 0x4000){
+        catchUpAccess();
+        return (this->*readers2000_[addr & 7])(addr);
+    }
+    if(addr < 0x4020){
+        cpu_.syncApu();
+        return (this->*readers4000_[addr & 0x1F])(addr);
+    }
+    return 0;
 }
 
-void Nes::writeRam(uint16_t addr, uint8_t value)
+void Nes::writeIo(uint16_t addr, uint8_t value)
 {
-    ram_[addr] = value;
+    if(addr < 0x4000){
+        catchUpAccess();
+        (this->*writers2000_[addr & 7])(addr, value);
+        scheduleCatchUp();
+    }
+    else if(addr < 0x4020){
+        cpu_.syncApu();
+        (this->*writers4000_[addr & 0x1F])(addr, value);
+    }
 }
 
-uint8_t Nes::readRamMirror(uint16_t addr)
-{
-    return ram_[addr & 0x7FF];
-}
 
-void Nes::writeRamMirror(uint16_t addr, uint8_t value)
+uint8_t Nes::readNull(uint16_t) { return 0; }
+void Nes::writeNull(uint16_t, uint8_t) {}
+
+uint8_t Nes::read200x(uint16_t) { return ppu_.read200x(); }
+uint8_t Nes::read2004(uint16_t) { return ppu_.read2004(); }
+
+// $2002 の読み取りはVBLANKフラグやトグルをクリアするが、書き込みを挟ま
+// ず同じ値(VBLANKフラグなし)を読み続ける限り何も変えない
+uint8_t Nes::read2002(uint16_t)
 {
-    ram_[addr & 0x7FF] = value;
+    uint8_t ret = ppu_.read2002();
+    if(ret != last2002_ || (ret & 0x80)) ++sideEffects_;
+    last2002_ = ret;
+    return ret;
 }
 
-uint8_t Nes::readPrg(uint16_t addr)
+uint8_t Nes::read2007(uint16_t)
 {
-    return prg_[addr - 0x8000];
+    ++sideEffects_;
+    last2002_ = 0x100;
+    return ppu_.read2007();
 }
 
-uint8_t Nes::read200x(uint16_t) { return ppu_.read200x(); }
-uint8_t Nes::read2002(uint16_t) { return ppu_.read2002(); }
-uint8_t Nes::read2004(uint16_t) { return ppu_.read2004(); }
-uint8_t Nes::read2007(uint16_t) { return ppu_.read2007(); }
-
 void Nes::write2000(uint16_t, uint8_t value) { ppu_.write2000(value); }
 void Nes::write2001(uint16_t, uint8_t value) { ppu_.write2001(value); }
 void Nes::write2002(uint16_t, uint8_t value) { ppu_.write2002(value); }
 void Nes::write2003(uint16_t, uint8_t value) { ppu_.write2003(value); }
-void Nes::write2004(uint16_t, uint8_t value) { ppu_.write2004(value); }
+void Nes::write2004(uint16_t, uint8_t value) { ppu_.write2004(value); ++oamWrites_; }
 void Nes::write2005(uint16_t, uint8_t value) { ppu_.write2005(value); }
 void Nes::write2006(uint16_t, uint8_t value) { ppu_.write2006(value); }
 void Nes::write2007(uint16_t, uint8_t value) { ppu_.write2007(value); }
 
 void Nes::write4014(uint16_t, uint8_t value)
 {
+    catchUpAccess();
+
     uint16_t addr_base = value << 8;
     array<uint8_t, 0x100> buf;
     for(int i = 0; i < 0x100; ++i)
@@ -341,9 +811,16 @@ void Nes::write4014(uint16_t, uint8_t value)
 
     cpu_.oamDmaDelay();
     ppu_.oamDma(buf.data());
+    ++oamWrites_;
+
+    scheduleCatchUp();
 }
 
-uint8_t Nes::read4015(uint16_t) { return apu_.read4015(); }
+uint8_t Nes::read4015(uint16_t)
+{
+    ++sideEffects_;
+    return apu_.read4015();
+}
 void Nes::write4000(uint16_t, uint8_t value) { apu_.write4000(value); }
 void Nes::write4001(uint16_t, uint8_t value) { apu_.write4001(value); }
 void Nes::write4002(uint16_t, uint8_t value) { apu_.write4002(value); }
@@ -368,6 +845,7 @@ void Nes::write4017(uint16_t, uint8_t value) { apu_.write4017(value); }
 uint8_t Nes::read4016(uint16_t)
 {
     // fourscoreでなければこれでよい?
+    ++sideEffects_;
     unsigned int bit = inputBit_[0];
     uint8_t ret = bit >= 8 ? 1 : ((input_[0]>>bit)&1);
     ++inputBit_[0];
@@ -377,6 +855,7 @@ uint8_t Nes::read4016(uint16_t)
 uint8_t Nes::read4017(uint16_t)
 {
     // fourscoreでなければこれでよい?
+    ++sideEffects_;
     unsigned int bit = inputBit_[1];
     uint8_t ret = bit >= 8 ? 1 : ((input_[1]>>bit)&1);
     ++inputBit_[1];
@@ -393,57 +872,6 @@ void Nes::write4016(uint16_t, uint8_t value)
     inputStrobe_ = strobe_req;
 }
 
-uint8_t Nes::readPpuChr(uint16_t addr)
-{
-    return chr_[addr];
-}
-
-namespace{
-    uint16_t vram_addr_horiz(uint16_t addr)
-    {
-        uint16_t hi = (addr & 0x800) >> 1;
-        uint16_t lo = addr & 0x3FF;
-        return hi | lo;
-    }
-
-    uint16_t vram_addr_vert(uint16_t addr)
-    {
-        uint16_t hi = addr & 0x400;
-        uint16_t lo = addr & 0x3FF;
-        return hi | lo;
-    }
-}
-
-uint8_t Nes::readPpuVramH(uint16_t addr)
-{
-    return vram_[vram_addr_horiz(addr)];
-}
-
-void Nes::writePpuVramH(uint16_t addr, uint8_t value)
-{
-    vram_[vram_addr_horiz(addr)] = value;
-}
-
-uint8_t Nes::readPpuVramV(uint16_t addr)
-{
-    return vram_[vram_addr_vert(addr)];
-}
-
-void Nes::writePpuVramV(uint16_t addr, uint8_t value)
-{
-    vram_[vram_addr_vert(addr)] = value;
-}
-
-uint8_t Nes::readPpuPltram(uint16_t addr)
-{
-    return ppu_.readPltram(addr);
-}
-
-void Nes::writePpuPltram(uint16_t addr, uint8_t value)
-{
-    ppu_.writePltram(addr, value);
-}
-
 
 Nes::CpuDoor::CpuDoor(Nes& nes) : nes_(nes) {}
 
@@ -462,6 +890,16 @@ void Nes::CpuDoor::tickApu(int cycle)
     nes_.apu_.tick(cycle);
 }
 
+int Nes::CpuDoor::apuNextEvent()
+{
+    return nes_.apu_.nextEvent();
+}
+
+unsigned int Nes::CpuDoor::sideEffectCount()
+{
+    return nes_.sideEffects_;
+}
+
 
 Nes::PpuDoor::PpuDoor(Nes& nes) : nes_(nes) {}
 
@@ -481,6 +919,22 @@ void Nes::PpuDoor::triggerNmi()
 }
 
 
+Nes::RenderDoor::RenderDoor(Nes& nes) : nes_(nes) {}
+
+uint8_t Nes::RenderDoor::readPpu(uint16_t addr)
+{
+    // パレットは PpuRenderState で渡すのでここには来ない
+    if(addr < 0x2000) return nes_.chr_[addr];
+
+    uint16_t offset = nes_.mirror_ == JUNKNES_MIRROR_H ? vram_addr_horiz(addr) : vram_addr_vert(addr);
+    return nes_.renderVram_[offset];
+}
+
+void Nes::RenderDoor::writePpu(uint16_t, uint8_t) {}
+
+void Nes::RenderDoor::triggerNmi() {}
+
+
 Nes::ApuDoor::ApuDoor(Nes& nes) : nes_(nes) {}
 
 uint8_t Nes::ApuDoor::readDmc(uint16_t addr)
@@ -500,3 +954,10 @@ void Nes::ApuDoor::triggerFrameIrq()
 {
     nes_.triggerIrq();
 }
+
+
+#ifdef JUNKNES_STATIC_BUS
+template class BasicCpu<Nes::CpuDoor>;
+template class BasicPpu<Nes::PpuDoor>;
+template class BasicPpu<Nes::RenderDoor>;
+#endif
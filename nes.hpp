@@ -1,6 +1,12 @@
 #pragma once
 
 #include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
 #include <cstdint>
 
 #include "junknes.h"
@@ -11,6 +17,7 @@
 class Nes{
 public:
     Nes(const std::uint8_t* prg, const std::uint8_t* chr, JunknesMirroring mirror);
+    ~Nes();
 
     void hardReset();
     void softReset();
@@ -20,36 +27,80 @@ public:
     void emulateFrame();
 
     const std::uint8_t* screen() const;
+    const std::uint8_t* ram() const;
+
+    // 描画したラインを palette (0x40色) で変換して dst にも書き込む
+    // dst == nullptr なら解除
+    void setScreenTarget(const std::uint32_t* palette, void* dst, int pitch);
+    // dst の内容がフレーム間で保たれるなら、変化のないラインを書き込まない
+    void setScreenTargetPersistent(bool persistent);
+
+    // 直前の emulateFrame() でスクリーンが書き換わらなかったか
+    bool frameUnchanged() const;
 
     JunknesSound sound() const;
+    void setSampleRate(int freq);
+    int readSamples(std::int16_t* buf, int max);
+    void setSoundOff(bool off);
 
     void beforeExec(JunknesCpuHook hook, void* userdata);
 
+    void setSpriteLimit(bool enabled);
+    void setRenderMode(int mode);
+    void setRenderThread(bool enabled);
+
 private:
     void initRW();
     void initRWPpu();
+    std::array<const std::uint8_t*, 4> nametables(const std::uint8_t* vram) const;
 
     void triggerNmi();
     void triggerIrq();
 
+    // イベントスケジューラ
+    // 時刻はフレーム先頭からのPPUサイクル。CPUは次のイベントまで止まら
+    // ずに実行される。ハンドラは次のイベントを自分で登録する
+    using EventHandler = void (Nes::*)(int arg);
+    void schedule(int time, EventHandler handler, int arg=0);
+    void runEvents();
+
+    void eventWarmupEnd(int);
+    void eventVBlank(int);
+    void eventNmi(int);
+    void eventPreRender(int);
+    void eventReloadAddr(int);
+    void eventCatchUp(int);
+    void eventFrameEnd(int);
+
+    // 遅延描画: ラインの処理はPPUレジスタへのアクセス時とフレーム終了時
+    // にまとめて行う
+    int lineTime(int line) const;
+    void catchUp(int time);
+    void catchUpAccess();
+    void scheduleCatchUp();
+    void processLine(int line);
+
+    void convertLine(int line, const std::uint8_t* buf);
+    std::uint64_t lineInputHash();
+
+    // 描画スレッド
+    void recordLine(int line);
+    void renderWorker(int tail, unsigned int done);
+    void waitRender();
+
     std::uint8_t read(std::uint16_t addr); // not const
     void write(std::uint16_t addr, std::uint8_t value);
 
     std::uint8_t readPpu(std::uint16_t addr); // こっちは const でもいいかもしれないけど…
     void writePpu(std::uint16_t addr, std::uint8_t value);
 
+    std::uint8_t readIo(std::uint16_t addr);
+    void writeIo(std::uint16_t addr, std::uint8_t value);
+
 
     std::uint8_t readNull(std::uint16_t);
     void writeNull(std::uint16_t, std::uint8_t);
 
-    std::uint8_t readRam(std::uint16_t addr);
-    void writeRam(std::uint16_t addr, std::uint8_t value);
-
-    std::uint8_t readRamMirror(std::uint16_t addr);
-    void writeRamMirror(std::uint16_t addr, std::uint8_t value);
-
-    std::uint8_t readPrg(std::uint16_t addr);
-
     std::uint8_t read200x(std::uint16_t);
     std::uint8_t read2002(std::uint16_t);
     std::uint8_t read2004(std::uint16_t);
@@ -92,29 +143,20 @@ private:
     void write4016(std::uint16_t, std::uint8_t value);
 
 
-    std::uint8_t readPpuChr(std::uint16_t addr);
-
-    std::uint8_t readPpuVramH(std::uint16_t addr);
-    void writePpuVramH(std::uint16_t addr, std::uint8_t value);
-    std::uint8_t readPpuVramV(std::uint16_t addr);
-    void writePpuVramV(std::uint16_t addr, std::uint8_t value);
-
-    std::uint8_t readPpuPltram(std::uint16_t addr);
-    void writePpuPltram(std::uint16_t addr, std::uint8_t value);
-
-
-    class CpuDoor : public Cpu::Door{
+    class CpuDoor final : public Cpu::Door{
     public:
         explicit CpuDoor(Nes& nes);
         std::uint8_t read(std::uint16_t addr) override;
         void write(std::uint16_t addr, std::uint8_t value) override;
 
         void tickApu(int cycle) override;
+        int apuNextEvent() override;
+        unsigned int sideEffectCount() override;
     private:
         Nes& nes_;
     };
 
-    class PpuDoor : public Ppu::Door{
+    class PpuDoor final : public Ppu::Door{
     public:
         explicit PpuDoor(Nes& nes);
         std::uint8_t readPpu(std::uint16_t addr) override;
@@ -124,7 +166,18 @@ private:
         Nes& nes_;
     };
 
-    class ApuDoor : public Apu::Door{
+    // 描画スレッド側のPPU用。VRAMはスナップショットを読む
+    class RenderDoor final : public Ppu::Door{
+    public:
+        explicit RenderDoor(Nes& nes);
+        std::uint8_t readPpu(std::uint16_t addr) override;
+        void writePpu(std::uint16_t addr, std::uint8_t value) override;
+        void triggerNmi() override;
+    private:
+        Nes& nes_;
+    };
+
+    class ApuDoor final : public Apu::Door{
     public:
         explicit ApuDoor(Nes& nes);
         std::uint8_t readDmc(std::uint16_t addr) override;
@@ -142,23 +195,132 @@ private:
     std::array<std::uint8_t, 0x800> ram_;
     std::array<std::uint8_t, 0x800> vram_;
 
+    // JUNKNES_STATIC_BUS: CPU/PPUを具象Door型でインスタンス化し、バス
+    // アクセスの仮想関数呼び出しをなくす(nes.cpp に実装ごと取り込む)
+#ifdef JUNKNES_STATIC_BUS
+    BasicCpu<CpuDoor> cpu_;
+    BasicPpu<PpuDoor> ppu_;
+    BasicPpu<RenderDoor> renderPpu_;
+#else
     Cpu cpu_;
     Ppu ppu_;
+    Ppu renderPpu_;
+#endif
     Apu apu_;
 
     int ppuWarmup_;
     bool oddFrame_;
 
+    // 描画モード(junknes_set_render_mode() 参照)
+    int renderMode_;
+    int skipCount_;     // 前回描画してから飛ばしたフレーム数
+    bool renderFrame_;  // 現フレームを描画するか
+
+    struct Event{
+        int time; // PPU cycle
+        int seq;  // 同時刻のイベントは登録順に処理
+        EventHandler handler;
+        int arg;
+    };
+    struct EventLater{
+        bool operator()(const Event& lhs, const Event& rhs) const
+        {
+            return lhs.time != rhs.time ? lhs.time > rhs.time : lhs.seq > rhs.seq;
+        }
+    };
+    std::priority_queue<Event, std::vector<Event>, EventLater> events_;
+    int eventSeq_;
+    int frameTime_; // 現在時刻(フレーム先頭からのPPUサイクル)
+    int sliceEnd_;  // CPU実行中はそのスライスの終了時刻、それ以外は frameTime_
+
+    int lineBase_;    // line 0 の開始時刻
+    int nextLine_;    // 次に処理するライン(241 なら描画期間外)
+    int catchUpTime_; // 予約済みの eventCatchUp の最早時刻(なければ INT_MAX)
+
+    // 256Byte単位のページテーブル
+    // nullptr のページはI/Oとして readIo()/writeIo() などで処理する
+    std::array<const std::uint8_t*, 0x100> readPages_;
+    std::array<std::uint8_t*, 0x100> writePages_;
+    std::array<const std::uint8_t*, 0x40> readPagesPpu_;
+    std::array<std::uint8_t*, 0x40> writePagesPpu_;
+
+    std::array<std::uint8_t, 0x100> pageNull_; // 常に0を返すページ(読み取り専用)
+    std::array<std::uint8_t, 0x100> pageSink_; // 書き込みを捨てるページ(読み取りには使わない)
+
+    // I/Oレジスタ用のハンドラ ($2000-$2007, $4000-$401F)
     using Reader = std::uint8_t (Nes::*)(std::uint16_t);
     using Writer = void (Nes::*)(std::uint16_t, std::uint8_t);
-    std::array<Reader, 0x10000> readers_;
-    std::array<Writer, 0x10000> writers_;
-    std::array<Reader, 0x4000> readersPpu_;
-    std::array<Writer, 0x4000> writersPpu_;
+    std::array<Reader, 8> readers2000_;
+    std::array<Writer, 8> writers2000_;
+    std::array<Reader, 0x20> readers4000_;
+    std::array<Writer, 0x20> writers4000_;
+
+    // CPUから見た外部状態の変更回数(書き込み、副作用のある読み取り)
+    // 空ループ検出用
+    unsigned int sideEffects_;
+    unsigned int last2002_; // 直前の $2002 の読み取り値。無効なら0x100
 
     std::array<unsigned int, 2> input_;
     std::array<unsigned int, 2> inputBit_;
     bool inputStrobe_;
 
     std::array<std::uint8_t, 256*240> screen_;
+
+    std::uint8_t* target_; // setScreenTarget() の描画先(なければ nullptr)
+    int targetPitch_;
+    std::array<std::uint32_t, 0x40> targetPalette_;
+    std::uint8_t* targetLast_; // 最後に登録された描画先(解除後も残す)
+    bool targetPersistent_;    // setScreenTargetPersistent()
+    // 描画先の内容が screen_ と一致している(変化のないラインを書き込ま
+    // なくてよい)。targetPersistent_ の時だけ立つ
+    bool targetValid_;
+
+    /**
+     * 描画スレッド(setRenderThread())
+     *
+     * CPUスレッドは各ラインの開始時に描画に必要な状態を renderLines_ に
+     * 記録して次へ進み(スプライト0ヒットなどは skipLine() で同期的に処
+     * 理)、描画スレッドがそれを renderPpu_ で描画する。VRAM/OAMは変更が
+     * あった場合のみフレーム内のスナップショットを追加する
+     * PPUアクセスのないラインも一定ライン数ごとに記録する(scheduleCatchUp())
+     * フレーム終了時に描画スレッドの完了を待つので、emulateFrame() から
+     * 戻った時点でスクリーンは完成している
+     */
+    struct RenderLine{
+        int line;
+        PpuRenderState state;
+        const std::uint8_t* vram;
+        const std::uint8_t* oam; // 変更がなければ nullptr
+    };
+    std::thread renderThread_;
+    std::mutex renderMutex_;
+    std::condition_variable renderCond_;
+    std::atomic<unsigned int> renderPublished_; // 記録したライン数(通算)
+    std::atomic<unsigned int> renderDone_;      // 描画したライン数(通算)
+    std::atomic<bool> renderSleeping_;
+    std::atomic<bool> renderQuit_;
+    std::array<RenderLine, 240> renderLines_; // リングバッファ
+    int renderHead_; // renderLines_ に次に記録するスロット(CPUスレッド)
+    std::vector<std::array<std::uint8_t, 0x800>> vramSnaps_;
+    std::vector<std::array<std::uint8_t, 0x100>> oamSnaps_;
+    int vramSnapCount_;
+    int oamSnapCount_;
+    unsigned int vramWrites_; // VRAM/OAMの書き込み回数(スナップショットの要否判定用)
+    unsigned int oamWrites_;
+    unsigned int vramWritesSnap_;
+    unsigned int oamWritesSnap_;
+    const std::uint8_t* renderVram_; // RenderDoor が読むVRAM(描画スレッドのみ)
+
+    // 変化のないラインの検出。lineHash_ は screen_ の各ラインを描画した
+    // 時の lineInputHash() (0 なら無効)
+    // ハッシュの一致は入力の一致とみなすが、衝突すると古いラインが残り続
+    // けるので、描画したフレーム LINE_HASH_REFRESH_FRAMES 回ごとに全て無
+    // 効にして描画し直す(そのフレームは frameUnchanged() が false になる)
+    std::array<std::uint64_t, 240> lineHash_;
+    int lineHashAge_; // lineHash_ を最後に無効にしてから描画したフレーム数
+    std::uint64_t vramHash_;
+    std::uint64_t oamHash_;
+    unsigned int vramWritesHash_;
+    unsigned int oamWritesHash_;
+    bool frameUnchanged_;
 };
@@ -0,0 +1,80 @@
+#include <cstdint>
+
+#include "ppu.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#   define JUNKNES_COMPOSE_X86
+#   include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace{
+    using ComposeFunc = void (*)(const uint8_t*, const uint8_t*, const uint8_t*, uint8_t*);
+
+    // スプライトが不透明で、かつ「背面スプライトが不透明BGに隠される」
+    // 場合でなければスプライトを採用
+    void composeScalar(const uint8_t* bg, const uint8_t* spr, const uint8_t* plt, uint8_t* out)
+    {
+        for(int x = 0; x < 0x100; ++x){
+            bool bg_opaque  = bg[x] & 3;
+            bool spr_opaque = spr[x] & 3;
+            bool behind     = spr[x] & PPU_SPR_BEHIND;
+
+            uint8_t idx = (spr_opaque && !(behind && bg_opaque)) ? (spr[x] & 0x1F) : bg[x];
+            out[x] = plt[idx];
+        }
+    }
+
+#ifdef JUNKNES_COMPOSE_X86
+    // 16pxずつ、優先度はバイトマスクで、パレット参照は PSHUFB で行う
+    // パレットは32Byteなので下位/上位16Byteを引いて bit4 で選ぶ
+    __attribute__((target("ssse3")))
+    void composeSsse3(const uint8_t* bg, const uint8_t* spr, const uint8_t* plt, uint8_t* out)
+    {
+        const __m128i zero   = _mm_setzero_si128();
+        const __m128i three  = _mm_set1_epi8(3);
+        const __m128i behind = _mm_set1_epi8(PPU_SPR_BEHIND);
+        const __m128i idxmsk = _mm_set1_epi8(0x1F);
+        const __m128i hibit  = _mm_set1_epi8(0x10);
+        const __m128i plt_lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(plt));
+        const __m128i plt_hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(plt + 0x10));
+
+        for(int x = 0; x < 0x100; x += 16){
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bg + x));
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(spr + x));
+
+            __m128i bg_clear  = _mm_cmpeq_epi8(_mm_and_si128(b, three), zero);
+            __m128i spr_clear = _mm_cmpeq_epi8(_mm_and_si128(s, three), zero);
+            __m128i spr_back  = _mm_cmpeq_epi8(_mm_and_si128(s, behind), behind);
+
+            // BGを採用するピクセル: スプライト透明 or (背面 and BG不透明)
+            __m128i use_bg = _mm_or_si128(spr_clear, _mm_andnot_si128(bg_clear, spr_back));
+            __m128i idx = _mm_or_si128(_mm_and_si128(use_bg, b),
+                                       _mm_andnot_si128(use_bg, _mm_and_si128(s, idxmsk)));
+
+            __m128i lo  = _mm_shuffle_epi8(plt_lo, idx);
+            __m128i hi  = _mm_shuffle_epi8(plt_hi, idx);
+            __m128i sel = _mm_cmpeq_epi8(_mm_and_si128(idx, hibit), hibit);
+            __m128i color = _mm_or_si128(_mm_andnot_si128(sel, lo), _mm_and_si128(sel, hi));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), color);
+        }
+    }
+#endif
+
+    ComposeFunc selectCompose()
+    {
+#ifdef JUNKNES_COMPOSE_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("ssse3")) return composeSsse3;
+#endif
+        return composeScalar;
+    }
+}
+
+void ppuComposeLine(const uint8_t* bg, const uint8_t* spr, const uint8_t* plt, uint8_t* out)
+{
+    static const ComposeFunc compose = selectCompose();
+    compose(bg, spr, plt, out);
+}
@@ -0,0 +1,850 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <cstdint>
+#include <cassert>
+#include <cstring>
+
+// BasicPpu の実装
+// インスタンス化する翻訳単位でのみインクルードする(ppu.cpp, nes.cpp, bench.cpp, test.cpp)
+
+#include "ppu.hpp"
+#include "util.hpp"
+
+using namespace std;
+
+
+template<typename DoorT>
+BasicPpu<DoorT>::BasicPpu(const shared_ptr<Door>& door)
+    : door_(door), chrDecoded_(false), nametables_(), sprLimit_(false), sprDirty_(true)
+{
+    
+}
+
+namespace{
+    /**
+     * パターンの1行(下位/上位プレーン)を、各バイトが1pxのカラー番号
+     * [0,3] となる64bit値にする。最下位バイトが左端
+     * flip なら左右反転
+     */
+    uint64_t DECODE_PATTERN_ROW(uint8_t lo, uint8_t hi, bool flip)
+    {
+        uint64_t row = 0;
+        for(int j = 0; j < 8; ++j){
+            int shift = flip ? j : 7-j;
+            uint64_t px = ((lo>>shift)&1) | (((hi>>shift)&1)<<1);
+            row |= px << (8*j);
+        }
+        return row;
+    }
+
+    // パターンの1行(1プレーン)の左右反転
+    uint8_t REVERSE_BITS(uint8_t b)
+    {
+        b = ((b&0xF0)>>4) | ((b&0x0F)<<4);
+        b = ((b&0xCC)>>2) | ((b&0x33)<<2);
+        b = ((b&0xAA)>>1) | ((b&0x55)<<1);
+        return b;
+    }
+}
+
+/**
+ * パターンテーブル($0000-$1FFF)が不変(CHR-ROM)であることを前提に、全
+ * タイルの全行をデコードしておく。chr は8KB
+ */
+template<typename DoorT>
+void BasicPpu<DoorT>::decodeChr(const uint8_t* chr)
+{
+    for(unsigned int tile = 0; tile < 0x200; ++tile){
+        for(unsigned int y = 0; y < 8; ++y){
+            uint8_t lo = chr[16*tile + y];
+            uint8_t hi = chr[16*tile + y + 8];
+            chrRows_[8*tile + y]     = DECODE_PATTERN_ROW(lo, hi, false);
+            chrRowsFlip_[8*tile + y] = DECODE_PATTERN_ROW(lo, hi, true);
+        }
+    }
+
+    chrDecoded_ = true;
+}
+
+template<typename DoorT>
+void BasicPpu<DoorT>::mapNametables(const array<const uint8_t*, 4>& nt)
+{
+    nametables_ = nt;
+}
+
+// パターンの1行を取得する(形式は DECODE_PATTERN_ROW() と同じ)
+template<typename DoorT>
+uint64_t BasicPpu<DoorT>::patternRow(uint16_t pat_addr, bool flip)
+{
+    if(chrDecoded_){
+        unsigned int idx = ((pat_addr>>4)<<3) | (pat_addr&7);
+        return flip ? chrRowsFlip_[idx] : chrRows_[idx];
+    }
+
+    uint8_t pat_lo = door_->readPpu(pat_addr);
+    uint8_t pat_hi = door_->readPpu(pat_addr + 8);
+    return DECODE_PATTERN_ROW(pat_lo, pat_hi, flip);
+}
+
+template<typename DoorT>
+void BasicPpu<DoorT>::setSpriteLimit(bool b)
+{
+    sprLimit_ = b;
+    sprDirty_ = true;
+}
+
+template<typename DoorT>
+void BasicPpu<DoorT>::hardReset()
+{
+    oam_.fill(0);
+    pltram_.fill(0);
+
+    ctrl_.raw = 0;
+    mask_.raw = 0;
+    status_.raw = 0;
+    oamAddr_ = 0;
+
+    regV_.raw = 0;
+    regT_.raw = 0;
+    regX_ = 0;
+    regW_ = false;
+
+    readBuf_ = 0;
+
+    genLatch_ = 0;
+
+    sprDirty_ = true;
+}
+
+template<typename DoorT>
+void BasicPpu<DoorT>::softReset()
+{
+    ctrl_.raw = 0;
+    mask_.raw = 0;
+
+    regV_.raw = 0;
+    regT_.raw = 0;
+    regX_ = 0;
+    regW_ = false;
+
+    readBuf_ = 0;
+
+    genLatch_ = 0;
+
+    sprDirty_ = true;
+}
+
+#if 0
+template<typename DoorT>
+void BasicPpu<DoorT>::startFrame()
+{
+    status_.vbl = 0;
+
+    // NesDevWikiだと一部のbitはコピーしないような書き方だけど…
+    if(isRenderingOn())
+        regV_ = regT_;
+}
+#endif
+
+template<typename DoorT>
+bool BasicPpu<DoorT>::nmiEnabled() const { return ctrl_.nmi; }
+template<typename DoorT>
+void BasicPpu<DoorT>::setSprOver(bool b) { status_.spr_over = b; }
+template<typename DoorT>
+void BasicPpu<DoorT>::setSpr0Hit(bool b) { status_.spr0_hit = b; }
+template<typename DoorT>
+void BasicPpu<DoorT>::setVBlank(bool b)  { status_.vbl = b; }
+
+template<typename DoorT>
+void BasicPpu<DoorT>::resetOamAddr()
+{
+    oamAddr_ = oamAddrLo_ = 0;
+}
+
+template<typename DoorT>
+void BasicPpu<DoorT>::reloadAddr()
+{
+    if(isRenderingOn()) regV_ = regT_;
+}
+
+template<typename DoorT>
+void BasicPpu<DoorT>::startLine()
+{
+    if(isRenderingOn()){
+        // x方向のスクロール初期化(nt の bit0, および x_coarse 復帰)
+        regV_.x_coarse = regT_.x_coarse;
+        regV_.nt = (regV_.nt&2) | (regT_.nt&1);
+    }
+}
+
+template<typename DoorT>
+template<PpuRenderer R>
+void BasicPpu<DoorT>::doLine(int line, uint8_t* buf)
+{
+    if(R == PpuRenderer::DOT)
+        renderLineDot(line, buf);
+    else
+        renderLine(line, buf);
+
+    if(checkSpr0(line))
+        status_.spr0_hit = true;
+}
+
+/**
+ * フレームスキップ用。CPUから見える状態(regV_, スプライト0ヒット)のみ
+ * doLine() と同じになるよう更新する
+ */
+template<typename DoorT>
+void BasicPpu<DoorT>::skipLine(int line)
+{
+    // renderLineBg() での x increment 33回分
+    if(mask_.bg_on){
+        unsigned int x = regV_.x_coarse + 33;
+        if((x>>5) & 1) regV_.nt ^= 1;
+        regV_.x_coarse = x & 31;
+    }
+
+    if(checkSpr0(line))
+        status_.spr0_hit = true;
+}
+
+// 現在の状態のまま描画が進んだ場合に、最初にスプライト0ヒットが起こる
+// ライン(既にヒット済みなら -1)
+template<typename DoorT>
+int BasicPpu<DoorT>::nextSpr0Line(int from)
+{
+    if(status_.spr0_hit) return -1;
+    if(!mask_.bg_on || !mask_.spr_on) return -1;
+
+    if(sprDirty_) evalSprites();
+    for(int line = from; line < 240; ++line)
+        if(spr0Lines_[line]) return line;
+    return -1;
+}
+
+template<typename DoorT>
+void BasicPpu<DoorT>::endLine()
+{
+    if(!isRenderingOn()) return;
+
+    // y increment
+    if(regV_.y_fine != 7){
+        ++regV_.y_fine;
+    }
+    else{
+        regV_.y_fine = 0;
+        if(regV_.y_coarse == 29){
+            regV_.y_coarse = 0;
+            regV_.nt ^= 2;
+        }
+        else if(regV_.y_coarse == 31){
+            regV_.y_coarse = 0;
+        }
+        else{
+            ++regV_.y_coarse;
+        }
+    }
+}
+
+#if 0
+template<typename DoorT>
+void BasicPpu<DoorT>::startVBlank()
+{
+    status_.vbl = 1;
+
+    if(ctrl_.nmi)
+        door_->triggerNmi();
+
+    status_.spr0_hit = false; // 本来はpre-renderのdot1でクリアされるらしい
+}
+#endif
+
+template<typename DoorT>
+void BasicPpu<DoorT>::oamDma(const uint8_t buf[0x100])
+{
+    // 開始アドレスは OAMADDR に依存するのかもしれないが、とりあえず
+    // FCEUXと同じ実装にしておく
+    copy(buf, buf+0x100, oam_.begin());
+    sprDirty_ = true;
+}
+
+template<typename DoorT>
+const uint8_t* BasicPpu<DoorT>::oam() const
+{
+    return oam_.data();
+}
+
+template<typename DoorT>
+void BasicPpu<DoorT>::saveRenderState(PpuRenderState& st) const
+{
+    st.ctrl = ctrl_.raw;
+    st.mask = mask_.raw;
+    st.regV = regV_.raw;
+    st.regX = regX_;
+    st.pltram = pltram_;
+}
+
+template<typename DoorT>
+void BasicPpu<DoorT>::loadRenderState(const PpuRenderState& st)
+{
+    if((ctrl_.raw ^ st.ctrl) & 0x28) sprDirty_ = true; // spr_pat, spr16
+    ctrl_.raw = st.ctrl;
+    mask_.raw = st.mask;
+    regV_.raw = st.regV;
+    regX_ = st.regX;
+    pltram_ = st.pltram;
+}
+
+template<typename DoorT>
+uint8_t BasicPpu<DoorT>::read200x()
+{
+    return genLatch_;
+}
+
+template<typename DoorT>
+uint8_t BasicPpu<DoorT>::read2002()
+{
+    Status ret = status_;
+    ret.garbage = genLatch_ & 0x1F;
+
+    status_.vbl = 0;
+    regW_ = false;
+
+    genLatch_ = ret.raw;
+    return ret.raw;
+}
+
+template<typename DoorT>
+uint8_t BasicPpu<DoorT>::read2004()
+{
+    return genLatch_; // FCEUX oldppuと同じ
+}
+
+template<typename DoorT>
+uint8_t BasicPpu<DoorT>::read2007()
+{
+    uint8_t ret;
+
+    if(regV_.addr < 0x3F00){
+        ret = genLatch_ = readBuf_;
+        readBuf_ = door_->readPpu(regV_.addr);
+    }
+    else{ // PLTRAM (not buffered)
+        ret = readPltram(regV_.addr);
+        readBuf_ = door_->readPpu(regV_.addr - 0x1000);
+    }
+
+    // VBLANK外で読み取った際の regV_ の挙動は省略
+    regV_.addr += ctrl_.inc32 ? 32 : 1;
+
+    return ret;
+}
+
+template<typename DoorT>
+void BasicPpu<DoorT>::write2000(uint8_t value)
+{
+    genLatch_ = value;
+
+    bool nmi_prev = ctrl_.nmi;
+    if((ctrl_.raw ^ value) & 0x28) sprDirty_ = true; // spr_pat, spr16
+    ctrl_.raw = value;
+    if(!nmi_prev && ctrl_.nmi && status_.vbl)
+        door_->triggerNmi();
+
+    regT_.nt = ctrl_.nt;
+}
+
+template<typename DoorT>
+void BasicPpu<DoorT>::write2001(uint8_t value)
+{
+    genLatch_ = value;
+    mask_.raw = value;
+}
+
+template<typename DoorT>
+void BasicPpu<DoorT>::write2002(uint8_t value)
+{
+    genLatch_ = value;
+}
+
+template<typename DoorT>
+void BasicPpu<DoorT>::write2003(uint8_t value)
+{
+    genLatch_ = value;
+
+    oamAddr_   = value;
+    oamAddrLo_ = value & 7;
+}
+
+template<typename DoorT>
+void BasicPpu<DoorT>::write2004(uint8_t value)
+{
+    genLatch_ = value;
+
+    if(oamAddrLo_ < 8){
+        oam_[oamAddrLo_] = value;
+    }
+    else{
+        if(oamAddr_ >= 8) oam_[oamAddr_] = value;
+    }
+    sprDirty_ = true;
+
+    ++oamAddr_;
+    ++oamAddrLo_;
+}
+
+template<typename DoorT>
+void BasicPpu<DoorT>::write2005(uint8_t value)
+{
+    genLatch_ = value;
+
+    if(!regW_){ // 1st
+        regT_.x_coarse = value >> 3;
+        regX_          = value & 7;
+    }
+    else{ // 2nd
+        regT_.y_coarse = value >> 3;
+        regT_.y_fine   = value & 7;
+    }
+
+    regW_ ^= 1;
+}
+
+template<typename DoorT>
+void BasicPpu<DoorT>::write2006(uint8_t value)
+{
+    genLatch_ = value;
+
+    if(!regW_){ // 1st
+        regT_.raw &= ~(1<<14);
+        regT_.addr_hi = value & 0x3F;
+    }
+    else{ // 2nd
+        regT_.addr_lo = value;
+        regV_ = regT_;
+    }
+
+    regW_ ^= 1;
+}
+
+// FCEUX oldppuと同じ実装
+template<typename DoorT>
+void BasicPpu<DoorT>::write2007(uint8_t value)
+{
+    genLatch_ = value;
+
+    door_->writePpu(regV_.addr, value);
+
+    regV_.addr += ctrl_.inc32 ? 32 : 1;
+}
+
+template<typename DoorT>
+uint8_t BasicPpu<DoorT>::readPltram(uint16_t addr) const
+{
+    if(addr & 3){
+        return READPLT(addr & 0x1F);
+    }
+    else{ // $3F00, $3F04, ...
+        return READPLT(addr & 0xC);
+    }
+}
+
+template<typename DoorT>
+void BasicPpu<DoorT>::writePltram(uint16_t addr, uint8_t value)
+{
+    if(addr & 3){
+        pltram_[addr & 0x1F] = value & 0x3F;
+    }
+    else{ // $3F00, $3F04, ...
+        pltram_[addr & 0xC] = value & 0x3F;
+    }
+}
+
+template<typename DoorT>
+void BasicPpu<DoorT>::renderLine(int line, uint8_t* buf)
+{
+    /**
+     * BG、スプライトそれぞれのパレット番号を描画してから ppuComposeLine()
+     * で合成し、色に変換する
+     *
+     * 処理の簡略化のため、前後8pxの余裕を設けたバッファを使う
+     * (renderLineBg() のコメントも参照)
+     */
+    uint8_t bgbuf[8 + 0x100 + 8];  // BGのパレット番号(透明なら0)
+    uint8_t sprbuf[8 + 0x100 + 8]; // スプライトのパレット番号(SPR_BEHIND 付き、なければ0)
+
+    if(mask_.bg_on)
+        renderLineBg(line, bgbuf+8);
+    else
+        fill_n(bgbuf+8, 0x100, 0); // BGオフなら全て背景色とする
+
+    fill_n(sprbuf+8, 0x100, 0);
+    if(mask_.spr_on) renderLineSpr(line, sprbuf+8);
+
+    ppuComposeLine(bgbuf+8, sprbuf+8, pltram_.data(), buf);
+}
+
+// buf は前後8pxの余裕あり
+template<typename DoorT>
+void BasicPpu<DoorT>::renderLineBg(int /*line*/, uint8_t* buf)
+{
+    uint16_t pat_base = ctrl_.bg_pat ? 0x1000 : 0x0000;
+
+    /**
+     * スクロールオフセットはタイル境界に合っていないこともあるので、
+     * 1ラインの描画には都合33個のタイルを処理する必要がある。そこで、
+     * 前後8pxの余裕を設けたバッファに33タイル全体を書き込み、そこから
+     * 中央256pxのみスクリーンバッファへ書き戻す。
+     */
+    assert(nametables_[0]);
+
+    // p への書き込み(uint8_t*)は全てのメンバとエイリアスしうるので、ライ
+    // ン内で使う状態はローカルに置く(メンバのままだとタイルごとに読み直
+    // しになる)
+    Addr v(regV_.raw);
+    const array<const uint8_t*, 4> nametables = nametables_;
+    const uint64_t* chr_rows = chrRows_.data();
+
+    // ライン内で y は変わらない
+    unsigned int y_fine       = v.y_fine;
+    unsigned int nt_row       = 32*v.y_coarse;
+    unsigned int attr_row     = 0x3C0 + 8*(v.y_coarse>>2);
+    unsigned int attr_shift_y = (v.y_coarse&2) ? 4 : 0;
+
+    // 属性は2x2タイル単位で共通なので、x_coarse が偶数のタイル(と先頭)
+    // でのみ読む
+    uint64_t attr_mask = 0;
+
+    uint8_t* p = buf - regX_;
+    for(int i = 0; i < 33; ++i, p+=8){
+        unsigned int x_coarse = v.x_coarse;
+        const uint8_t* nt = nametables[v.nt];
+        uint8_t tile = nt[nt_row + x_coarse];
+
+        uint16_t pat_addr = pat_base + 16*tile + y_fine;
+        uint64_t row = chrDecoded_ ? chr_rows[((pat_addr>>4)<<3) | (pat_addr&7)]
+                                   : patternRow(pat_addr, false);
+
+        if(i == 0 || !(x_coarse&1)){
+            uint8_t attr_block = nt[attr_row + (x_coarse>>2)];
+            uint8_t attr_shift = attr_shift_y + ((x_coarse&2) ? 2 : 0);
+            uint8_t attr = (attr_block>>attr_shift) & 3;
+            attr_mask = UINT64_C(0x0101010101010101) * (attr<<2);
+        }
+
+        // タイル描画
+        // 不透明なピクセルにのみ属性を付ける(透明ピクセルは背景色 = 0)
+        uint64_t opaque = (row | (row>>1)) & UINT64_C(0x0101010101010101);
+        uint64_t idx = row | ((opaque * 0xFF) & attr_mask);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        memcpy(p, &idx, 8); // 1バイトずつ書くより速い(コンパイラがまとめない)
+#else
+        for(int j = 0; j < 8; ++j)
+            p[j] = idx >> (8*j);
+#endif
+
+        // x increment
+        if(x_coarse == 31){
+            v.x_coarse = 0;
+            v.nt ^= 1;
+        }
+        else{
+            v.x_coarse = x_coarse + 1;
+        }
+    }
+
+    regV_ = v;
+}
+
+namespace{
+    union SpriteAttr{
+        uint8_t raw;
+        explicit SpriteAttr(uint8_t value=0) : raw(value) {}
+        SpriteAttr& operator=(const SpriteAttr& rhs) { raw = rhs.raw; return *this; }
+        BitField8<0,2> plt;
+        BitField8<5>   bg;
+        BitField8<6>   flip_h;
+        BitField8<7>   flip_v;
+    };
+
+    struct Sprite{
+        uint8_t x;
+        uint8_t y;
+        SpriteAttr attr;
+        uint8_t h;
+        uint8_t tile;
+        uint16_t pat_base;
+
+        Sprite(uint8_t oam[4], bool spr16, bool spr_pat)
+        {
+            x = oam[3];
+            y = oam[0] + 1;
+            attr.raw = oam[2];
+
+            if(spr16){
+                h = 16;
+                tile = oam[1] & ~1;
+                pat_base = (oam[1]&1) ? 0x1000 : 0x0000;
+            }
+            else{
+                h = 8;
+                tile = oam[1];
+                pat_base = spr_pat ? 0x1000 : 0x0000;
+            }
+        }
+    };
+}
+
+/**
+ * 全スプライトをラインに割り当てる(OAM評価)
+ * 各ラインのリストは番号順。sprLimit_ なら9個目以降は捨てる
+ * スプライト0についてはヒット判定用に不透明ピクセルを持つラインも求める
+ */
+template<typename DoorT>
+void BasicPpu<DoorT>::evalSprites()
+{
+    unsigned int limit = sprLimit_ ? 8 : 64;
+
+    sprCount_.fill(0);
+    spr0Lines_.fill(false);
+
+    for(int i = 0; i < 64; ++i){
+        Sprite spr(oam_.data() + 4*i, ctrl_.spr16, ctrl_.spr_pat);
+
+        // y==0 (oam[0]==0xFF) なスプライトは表示されない
+        if(spr.y == 0) continue;
+
+        int end = min(spr.y + spr.h, 240);
+        for(int line = spr.y; line < end; ++line){
+            if(sprCount_[line] < limit)
+                sprLines_[line][sprCount_[line]++] = i;
+
+            if(i == 0){
+                int y_offset = line - spr.y;
+                if(spr.attr.flip_v)
+                    y_offset = spr.h-1 - y_offset;
+
+                uint8_t tile = spr.tile + (y_offset >= 8 ? 1 : 0);
+                uint16_t pat_addr = spr.pat_base + 16*tile + (y_offset&7);
+                spr0Lines_[line] = patternRow(pat_addr, false) != 0;
+            }
+        }
+    }
+
+    sprDirty_ = false;
+}
+
+// スプライトオーバーはとりあえず無視
+// buf は前後8pxの余裕あり。0で初期化しておくこと
+// 各ピクセルには最初に描画された(番号の小さい)スプライトが残る。BGとの
+// 優先度は ppuComposeLine() で処理する
+template<typename DoorT>
+void BasicPpu<DoorT>::renderLineSpr(int line, uint8_t* buf)
+{
+    // line 0ではスプライトは決して表示されない(y>=1 なので割り当てもない)
+    if(sprDirty_) evalSprites();
+
+    // このラインに割り当てられたスプライトのみ処理
+    for(unsigned int k = 0; k < sprCount_[line]; ++k){
+        Sprite spr(oam_.data() + 4*sprLines_[line][k], ctrl_.spr16, ctrl_.spr_pat);
+
+        int y_offset = line - spr.y;
+        if(spr.attr.flip_v)
+            y_offset = spr.h-1 - y_offset;
+
+        uint8_t tile = spr.tile + (y_offset >= 8 ? 1 : 0);
+
+        uint16_t pat_addr = spr.pat_base + 16*tile + (y_offset&7);
+        uint64_t row = patternRow(pat_addr, spr.attr.flip_h);
+
+        for(int j = 0; j < 8; ++j){
+            uint8_t px = (row >> (8*j)) & 3;
+
+            // 背面スプライトであっても優先度には影響しない
+            int x = spr.x + j;
+            if(px && !buf[x])
+                buf[x] = 0x10 | (spr.attr.plt<<2) | px | (spr.attr.bg ? PPU_SPR_BEHIND : 0);
+        }
+    }
+}
+
+/**
+ * ドット単位の描画(PpuRenderer::DOT)
+ *
+ * BGは8ドット周期でネームテーブル、属性、パターン下位/上位を2ドットず
+ * つかけてフェッチし、16bitのシフトレジスタから1ドットずつ取り出す。先
+ * 頭2タイルは実機では前ラインの dot 321-336 でフェッチするので、その分
+ * から始める。スプライトは前ラインの dot 257-320 に当たるパターンのフェ
+ * ッチを先頭で行い、各ユニットのXカウンタとシフトレジスタで出力する(ラ
+ * インへの割り当ては evalSprites() の結果を使う)
+ *
+ * 出力と regV_ の変化を renderLine() と同じにするため、実機とは以下が
+ * 異なる
+ *   - BGオフならフェッチしない(実機はスプライトのみ有効でも行う)
+ *   - dot 256 の x increment はしない(renderLine() と同じく33回)
+ *   - 左端8pxのクリッピングはしない
+ */
+template<typename DoorT>
+void BasicPpu<DoorT>::renderLineDot(int line, uint8_t* buf)
+{
+    assert(nametables_[0]);
+
+    const bool bg_on = mask_.bg_on;
+    const uint16_t bg_pat = ctrl_.bg_pat ? 0x1000 : 0x0000;
+    Addr v(regV_.raw);
+
+    // BGのシフトレジスタ(bit15が次のドット)とフェッチ先のラッチ
+    uint16_t pat_lo = 0, pat_hi = 0, attr_lo = 0, attr_hi = 0;
+    uint8_t nt_latch = 0, attr_latch = 0, lo_latch = 0, hi_latch = 0;
+
+    // step = (dot-1) % 8 のフェッチ
+    auto fetch = [&](int step, bool increment){
+        const uint8_t* nt = nametables_[v.nt];
+        switch(step){
+        case 0:
+            nt_latch = nt[32*v.y_coarse + v.x_coarse];
+            break;
+        case 2: {
+            uint8_t attr_block = nt[0x3C0 + 8*(v.y_coarse>>2) + (v.x_coarse>>2)];
+            int attr_shift = ((v.y_coarse&2) ? 4 : 0) + ((v.x_coarse&2) ? 2 : 0);
+            attr_latch = (attr_block>>attr_shift) & 3;
+            break;
+        }
+        case 4:
+            lo_latch = door_->readPpu(bg_pat + 16*nt_latch + v.y_fine);
+            break;
+        case 6:
+            hi_latch = door_->readPpu(bg_pat + 16*nt_latch + v.y_fine + 8);
+            break;
+        case 7:
+            if(!increment) break;
+            if(v.x_coarse == 31){
+                v.x_coarse = 0;
+                v.nt ^= 1;
+            }
+            else{
+                v.x_coarse = v.x_coarse + 1;
+            }
+            break;
+        }
+    };
+    auto shift = [&]{
+        pat_lo  <<= 1;
+        pat_hi  <<= 1;
+        attr_lo <<= 1;
+        attr_hi <<= 1;
+    };
+    auto reload = [&]{
+        pat_lo  |= lo_latch;
+        pat_hi  |= hi_latch;
+        attr_lo |= (attr_latch&1) ? 0xFF : 0;
+        attr_hi |= (attr_latch&2) ? 0xFF : 0;
+    };
+
+    // 前ラインの dot 321-337: 先頭2タイル
+    if(bg_on){
+        for(int dot = 321; dot <= 336; ++dot){
+            if(dot >= 322) shift();
+            if(dot == 329) reload();
+            fetch((dot-1) & 7, true);
+        }
+        shift();
+        reload();
+    }
+
+    // 前ラインの dot 257-320: スプライトのパターン
+    struct SprUnit{
+        uint8_t lo, hi; // シフトレジスタ(bit7が次のドット)
+        uint8_t attr;   // パレット番号と PPU_SPR_BEHIND
+        int counter;    // 出力開始までのドット数
+    };
+    array<SprUnit, 64> units;
+    unsigned int spr_count = 0;
+    if(mask_.spr_on){
+        if(sprDirty_) evalSprites();
+
+        spr_count = sprCount_[line];
+        for(unsigned int k = 0; k < spr_count; ++k){
+            Sprite spr(oam_.data() + 4*sprLines_[line][k], ctrl_.spr16, ctrl_.spr_pat);
+
+            int y_offset = line - spr.y;
+            if(spr.attr.flip_v)
+                y_offset = spr.h-1 - y_offset;
+
+            uint8_t tile = spr.tile + (y_offset >= 8 ? 1 : 0);
+            uint16_t pat_addr = spr.pat_base + 16*tile + (y_offset&7);
+            uint8_t lo = door_->readPpu(pat_addr);
+            uint8_t hi = door_->readPpu(pat_addr + 8);
+
+            SprUnit& unit = units[k];
+            unit.lo = spr.attr.flip_h ? REVERSE_BITS(lo) : lo;
+            unit.hi = spr.attr.flip_h ? REVERSE_BITS(hi) : hi;
+            unit.attr = 0x10 | (spr.attr.plt<<2) | (spr.attr.bg ? PPU_SPR_BEHIND : 0);
+            unit.counter = spr.x;
+        }
+    }
+
+    // dot 1-256
+    const int bit = 15 - regX_;
+    for(int dot = 1; dot <= 256; ++dot){
+        if(bg_on){
+            if(dot >= 2) shift();
+            if(dot >= 9 && ((dot-1)&7) == 0) reload();
+            fetch((dot-1) & 7, dot != 256);
+        }
+
+        uint8_t bg = ((pat_lo>>bit)&1) | (((pat_hi>>bit)&1)<<1);
+        if(bg)
+            bg |= (((attr_lo>>bit)&1) | (((attr_hi>>bit)&1)<<1)) << 2;
+
+        // 全ユニットが毎ドットシフトし、番号の小さい不透明ピクセルを採用
+        uint8_t spr = 0;
+        for(unsigned int k = 0; k < spr_count; ++k){
+            SprUnit& unit = units[k];
+            if(unit.counter > 0){
+                --unit.counter;
+                continue;
+            }
+            uint8_t px = ((unit.lo>>7)&1) | ((unit.hi>>6)&2);
+            unit.lo <<= 1;
+            unit.hi <<= 1;
+            if(px && !spr) spr = unit.attr | px;
+        }
+
+        // 合成(ppuComposeLine() と同じ)
+        bool behind = spr & PPU_SPR_BEHIND;
+        uint8_t idx = (spr && !(behind && bg)) ? (spr & 0x1F) : bg;
+        buf[dot-1] = pltram_[idx];
+    }
+
+    regV_ = v;
+}
+
+// bjneからパクったけど正しくない
+//   * BGも見なければならない
+//   * クリッピングが有効な場合、x=0 から x=7 では起こらない
+//   * x=255 では起こらない
+//   * 1フレームに1回しか起こらない
+template<typename DoorT>
+bool BasicPpu<DoorT>::checkSpr0(int line)
+{
+    if(!mask_.bg_on || !mask_.spr_on) return false;
+
+    if(sprDirty_) evalSprites();
+    return spr0Lines_[line];
+}
+
+template<typename DoorT>
+bool BasicPpu<DoorT>::isRenderingOn() const
+{
+    return mask_.bg_on || mask_.spr_on;
+}
+
+template<typename DoorT>
+uint8_t BasicPpu<DoorT>::READPLT(int offset) const
+{
+    // グレースケールはよくわからないので省略
+    return pltram_[offset];
+}
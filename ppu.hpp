@@ -6,21 +6,83 @@
 
 #include "util.hpp"
 
-class Ppu{
+// スプライトのパレット番号に付ける背面フラグ
+constexpr std::uint8_t PPU_SPR_BEHIND = 0x40;
+
+/**
+ * 1ライン(256px)の合成(ppu-compose.cpp)
+ *
+ * bg  : BGのパレット番号 [0,0x0F] (透明なら0)
+ * spr : スプライトのパレット番号 [0x10,0x1F] に PPU_SPR_BEHIND を付けたもの(なければ0)
+ * plt : パレットRAM(32Byte)
+ * out : 色番号
+ *
+ * 実行時にCPUを判定してSIMD版を使う
+ */
+void ppuComposeLine(const std::uint8_t* bg, const std::uint8_t* spr,
+                    const std::uint8_t* plt, std::uint8_t* out);
+
+/**
+ * 描画方式。BasicPpu::doLine() のデフォルトはビルド時に選ぶ
+ * (JUNKNES_PPU_DOT、scons PPU_DOT=1)
+ *
+ * LINE : 1ラインをタイル単位でまとめて描画する
+ * DOT  : 実機と同じフェッチとシフトレジスタで1ドットずつ描画する(遅い)
+ *
+ * 出力とCPUから見える状態はどちらでも同じ
+ */
+enum class PpuRenderer{ LINE, DOT };
+#ifdef JUNKNES_PPU_DOT
+constexpr PpuRenderer PPU_RENDERER = PpuRenderer::DOT;
+#else
+constexpr PpuRenderer PPU_RENDERER = PpuRenderer::LINE;
+#endif
+
+/**
+ * 1ラインの描画に必要なレジスタとパレット(描画スレッド用)
+ * BasicPpu::saveRenderState() で取り出し、別インスタンスに loadRenderState()
+ * で復元して描画する
+ */
+struct PpuRenderState{
+    std::uint8_t ctrl;
+    std::uint8_t mask;
+    std::uint16_t regV;
+    std::uint8_t regX;
+    std::array<std::uint8_t, 0x20> pltram;
+};
+
+// PPUから外部へアクセスするためのインターフェース(仮想関数版)
+class PpuBus{
 public:
-    class Door{
-    public:
-        virtual ~Door();
-        virtual std::uint8_t readPpu(std::uint16_t addr) = 0;
-        virtual void writePpu(std::uint16_t addr, std::uint8_t value) = 0;
-        virtual void triggerNmi() = 0;
-    };
+    virtual ~PpuBus();
+    virtual std::uint8_t readPpu(std::uint16_t addr) = 0;
+    virtual void writePpu(std::uint16_t addr, std::uint8_t value) = 0;
+    virtual void triggerNmi() = 0;
+};
 
-    explicit Ppu(const std::shared_ptr<Door>& door);
+/**
+ * DoorT は外部アクセス用の型で、PpuBus と同じメンバ関数を持つこと
+ * (BasicCpu と同様)。実装は ppu-impl.hpp
+ */
+template<typename DoorT>
+class BasicPpu{
+public:
+    using Door = DoorT;
+
+    explicit BasicPpu(const std::shared_ptr<Door>& door);
 
     void hardReset();
     void softReset();
 
+    void decodeChr(const std::uint8_t* chr);
+
+    // 4つの論理ネームテーブル($2000/$2400/$2800/$2C00, 各1KB)の実体
+    // ミラーリングに応じて所有者が設定する。BG描画はこれを直接読む
+    void mapNametables(const std::array<const std::uint8_t*, 4>& nt);
+
+    // 1ラインあたりのスプライト数を8個に制限するか(デフォルトは制限なし)
+    void setSpriteLimit(bool b);
+
     bool nmiEnabled() const;
     void setSprOver(bool b);
     void setSpr0Hit(bool b);
@@ -29,10 +91,16 @@ public:
     void reloadAddr();
 
     void startLine();
-    void doLine(int line, std::uint8_t* buf);
+    template<PpuRenderer R = PPU_RENDERER> void doLine(int line, std::uint8_t* buf);
+    void skipLine(int line); // 描画せずに doLine() と同じ状態変化だけ行う
+    int nextSpr0Line(int from); // from 以降でスプライト0ヒットが起こるライン(なければ -1)
     void endLine();
 
     void oamDma(const std::uint8_t buf[0x100]);
+    const std::uint8_t* oam() const;
+
+    void saveRenderState(PpuRenderState& st) const;
+    void loadRenderState(const PpuRenderState& st);
 
     std::uint8_t read200x();
     std::uint8_t read2002();
@@ -126,15 +194,35 @@ private:
 
     std::uint8_t genLatch_;
 
+    // デコード済みパターン(タイル512個 x 8行)。decodeChr() で作成
+    bool chrDecoded_;
+    std::array<std::uint64_t, 0x200*8> chrRows_;
+    std::array<std::uint64_t, 0x200*8> chrRowsFlip_; // 左右反転
+
+    std::array<const std::uint8_t*, 4> nametables_;
+
+    // ラインごとのスプライト割り当て(OAM評価)。OAM/$2000 が変更された
+    // ら無効化し、次に必要になった時点で evalSprites() で作り直す
+    bool sprLimit_;
+    bool sprDirty_;
+    std::array<std::uint8_t, 240> sprCount_;
+    std::array<std::array<std::uint8_t, 64>, 240> sprLines_; // スプライト番号(昇順)
+    std::array<bool, 240> spr0Lines_; // スプライト0の不透明ピクセルがあるライン
+
+    void evalSprites();
 
-    
 
     void renderLine(int line, std::uint8_t* buf);
-    void renderLineBg(int line, std::uint8_t* buf, bool* opacity);
-    void renderLineSpr(int line, std::uint8_t* buf, const bool* opacity);
+    void renderLineBg(int line, std::uint8_t* buf);
+    void renderLineSpr(int line, std::uint8_t* buf);
+    void renderLineDot(int line, std::uint8_t* buf);
     bool checkSpr0(int line);
 
+    std::uint64_t patternRow(std::uint16_t pat_addr, bool flip);
+
     bool isRenderingOn() const;
 
     std::uint8_t READPLT(int offset) const;
 };
+
+using Ppu = BasicPpu<PpuBus>;
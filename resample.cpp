@@ -0,0 +1,272 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+
+#include "resample.hpp"
+#include "apu.hpp"
+
+#if defined(__SSE__)
+#   define JUNKNES_RESAMPLE_SSE
+#   include <xmmintrin.h>
+#endif
+
+using namespace std;
+
+namespace{
+    constexpr double PI = 3.14159265358979323846;
+
+    // 2段目の遷移帯域幅(出力レートに対する比)。quality 1-3
+    constexpr double TRANSITION[Resampler::QUALITY_MAX+1] = { 0, 0.25, 0.12, 0.06 };
+
+    double sinc(double x)
+    {
+        return x == 0.0 ? 1.0 : sin(PI*x) / (PI*x);
+    }
+
+    // Blackman窓。範囲外は0
+    double blackman(double x, int width)
+    {
+        if(2*fabs(x) > width) return 0;
+        return 0.42 + 0.5*cos(2*PI*x/width) + 0.08*cos(4*PI*x/width);
+    }
+}
+
+// min() に参照で渡すので定義が必要(-O0 ではリンクエラーになる)
+constexpr int Resampler::QUALITY_MAX;
+
+Resampler::Resampler(double in_rate, int out_rate, int quality)
+    : quality_(min(max(quality, 0), QUALITY_MAX)), decim_(1), taps_(0),
+      pos_(0), decimCount_(0), cicScale_(0)
+{
+    assert(0 < out_rate && out_rate < in_rate);
+
+    integ_.fill(0);
+    comb_.fill(0);
+
+    if(!quality_){
+        step_ = static_cast<uint64_t>(in_rate / out_rate * 4294967296.0);
+        return;
+    }
+
+    // 1段目の出力が出力レートの4倍以上になる範囲で大きく間引く
+    for(int d = 8; d > 1; d /= 2){
+        if(in_rate/d >= 4.0*out_rate){
+            decim_ = d;
+            break;
+        }
+    }
+    double mid_rate = in_rate / decim_;
+    step_ = static_cast<uint64_t>(mid_rate / out_rate * 4294967296.0);
+    cicScale_ = 1.0f / (float(decim_)*decim_*decim_ * (1<<MIX_BITS));
+
+    for(int i = 0; i < 31; ++i)
+        mixPulse_[i] = lround(APU_MIX_PULSE[i] * (1<<MIX_BITS));
+    for(int i = 0; i < 203; ++i)
+        mixTnd_[i] = lround(APU_MIX_TND[i] * (1<<MIX_BITS));
+
+    // 2段目のカーネル。Blackman窓の遷移帯域幅はおよそ 5.5/タップ数
+    // 遷移帯域の中心を出力のナイキスト周波数より少し下に置く
+    double tw = TRANSITION[quality_] * out_rate / mid_rate;
+    taps_ = (static_cast<int>(ceil(5.5 / tw)) + 7) & ~7;
+    double cutoff = (0.5 - TRANSITION[quality_]/2) * out_rate / mid_rate; // 入力レートに対する比
+
+    // 位相 p の出力の時刻は hist_ 上で (先頭 + p/PHASES + (taps_-1)/2)
+    kernel_.resize(PHASES * taps_);
+    for(int p = 0; p < PHASES; ++p){
+        double frac = double(p) / PHASES;
+        float* h = kernel_.data() + p*taps_;
+        double sum = 0;
+        for(int k = 0; k < taps_; ++k){
+            double x = k - frac - (taps_-1)/2.0;
+            h[k] = sinc(2*cutoff*x) * blackman(x, taps_);
+            sum += h[k];
+        }
+        // DCゲインを1に
+        for(int k = 0; k < taps_; ++k)
+            h[k] /= sum;
+    }
+
+    // 使い終わった入力は容量が足りなくなった時にまとめて捨てるので、数フ
+    // レーム分確保しておく(1フレームは最大40000サイクル)
+    hist_.reserve(taps_ + HIST_FRAMES * (40000/decim_ + 1));
+}
+
+int Resampler::maxOutput(int len) const
+{
+    return static_cast<int>((uint64_t(len/decim_ + 1) << 32) / step_) + 2;
+}
+
+int Resampler::process(const JunknesSound& sound, float* out)
+{
+    return quality_ ? processFir(sound, out) : processPoint(sound, out);
+}
+
+int Resampler::processPoint(const JunknesSound& sound, float* out)
+{
+    int len = sound.sq1.len;
+
+    int n = 0;
+    for(; (pos_>>32) < static_cast<uint64_t>(len); pos_ += step_){
+        int i = pos_ >> 32;
+        int pulse = sound.sq1.data[i] + sound.sq2.data[i];
+        int tnd   = 3*sound.tri.data[i] + 2*sound.noi.data[i] + sound.dmc.data[i];
+        out[n++] = APU_MIX_PULSE[pulse] + APU_MIX_TND[tnd];
+    }
+    pos_ -= uint64_t(len) << 32;
+
+    return n;
+}
+
+namespace{
+    template<int D> struct FlatWord{};
+    template<> struct FlatWord<1> { using type = uint8_t; };
+    template<> struct FlatWord<2> { using type = uint16_t; };
+    template<> struct FlatWord<4> { using type = uint32_t; };
+    template<> struct FlatWord<8> { using type = uint64_t; };
+
+    // p[0,D) がすべて同じ値か
+    template<int D>
+    bool isFlat(const uint8_t* p)
+    {
+        using Word = typename FlatWord<D>::type;
+        Word w;
+        memcpy(&w, p, D);
+        return w == Word(p[0] * (Word(~Word(0)) / 0xFF));
+    }
+}
+
+/**
+ * ミックスしてCIC(積分3段 -> 1/D に間引き -> 差分3段)にかけ、hist_ に追加
+ *
+ * APUの出力は長い区間で一定なので、Dサイクルの間どのチャンネルも変化し
+ * なければ積分3段をまとめて進める。値 x が D サイクル続いたときの積分器は
+ *   i0' = i0 + D*x
+ *   i1' = i1 + D*i0 + D(D+1)/2*x
+ *   i2' = i2 + D*i1 + D(D+1)/2*i0 + D(D+1)(D+2)/6*x
+ */
+template<int D>
+void Resampler::runCic(const JunknesSound& sound)
+{
+    constexpr uint32_t T2 = D*(D+1)/2;
+    constexpr uint32_t T3 = D*(D+1)*(D+2)/6;
+
+    const int len = sound.sq1.len;
+    const uint8_t* sq1 = sound.sq1.data;
+    const uint8_t* sq2 = sound.sq2.data;
+    const uint8_t* tri = sound.tri.data;
+    const uint8_t* noi = sound.noi.data;
+    const uint8_t* dmc = sound.dmc.data;
+
+    // 状態はループ中ローカルに持つ
+    uint32_t i0 = integ_[0], i1 = integ_[1], i2 = integ_[2];
+    int count = decimCount_;
+
+    auto mix = [&](int i) -> uint32_t {
+        return mixPulse_[sq1[i] + sq2[i]] + mixTnd_[3*tri[i] + 2*noi[i] + dmc[i]];
+    };
+    auto integrate = [&](uint32_t x){
+        i0 += x;
+        i1 += i0;
+        i2 += i1;
+    };
+    auto emit = [&]{
+        uint32_t y = i2;
+        for(auto& c : comb_){
+            uint32_t prev = c;
+            c = y;
+            y -= prev;
+        }
+        hist_.push_back(static_cast<int32_t>(y) * cicScale_);
+    };
+
+    int i = 0;
+
+    // 前フレームから続く端数
+    for(; i < len && count; ++i){
+        integrate(mix(i));
+        if(++count == D){
+            count = 0;
+            emit();
+        }
+    }
+
+    for(; i+D <= len; i += D){
+        if(isFlat<D>(sq1+i) && isFlat<D>(sq2+i) && isFlat<D>(tri+i) &&
+           isFlat<D>(noi+i) && isFlat<D>(dmc+i)){
+            uint32_t x = mix(i);
+            i2 += D*i1 + T2*i0 + T3*x;
+            i1 += D*i0 + T2*x;
+            i0 += D*x;
+        }
+        else{
+            for(int j = 0; j < D; ++j)
+                integrate(mix(i+j));
+        }
+        emit();
+    }
+
+    // 次フレームに続く端数
+    for(; i < len; ++i){
+        integrate(mix(i));
+        ++count;
+    }
+
+    integ_ = { i0, i1, i2 };
+    decimCount_ = count;
+}
+
+int Resampler::processFir(const JunknesSound& sound, float* out)
+{
+    // 使い終わった入力(pos_ より前)は、このフレームの分が入りきらない場
+    // 合のみ捨てる。毎回 erase() すると残りを毎フレーム詰めることになる
+    size_t incoming = sound.sq1.len/decim_ + 1;
+    if(hist_.size() + incoming > hist_.capacity()){
+        size_t used = min<size_t>(pos_ >> 32, hist_.size());
+        hist_.erase(hist_.begin(), hist_.begin() + used);
+        pos_ -= uint64_t(used) << 32;
+    }
+
+    // 1段目
+    switch(decim_){
+    case 8: runCic<8>(sound); break;
+    case 4: runCic<4>(sound); break;
+    case 2: runCic<2>(sound); break;
+    default: runCic<1>(sound); break;
+    }
+
+    // 2段目: ポリフェーズFIR
+    int n = 0;
+    for(;;){
+        size_t idx = pos_ >> 32;
+        if(idx + taps_ > hist_.size()) break;
+        int phase = (pos_ >> (32-PHASE_BITS)) & (PHASES-1);
+        out[n++] = dot(hist_.data() + idx, kernel_.data() + phase*taps_);
+        pos_ += step_;
+    }
+
+    return n;
+}
+
+float Resampler::dot(const float* x, const float* h) const
+{
+#ifdef JUNKNES_RESAMPLE_SSE
+    // 8タップずつ、アキュムレータ2本
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for(int k = 0; k < taps_; k += 8){
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(x+k),   _mm_loadu_ps(h+k)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(x+k+4), _mm_loadu_ps(h+k+4)));
+    }
+    __m128 acc = _mm_add_ps(acc0, acc1);
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+    return _mm_cvtss_f32(acc);
+#else
+    float sum = 0;
+    for(int k = 0; k < taps_; ++k)
+        sum += x[k] * h[k];
+    return sum;
+#endif
+}
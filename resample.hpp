@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+#include "junknes.h"
+
+/**
+ * APUの出力(CPUサイクルごと)をミックスして出力レートに間引く
+ *
+ * quality 0 : フィルタなし。出力サンプルの位置の値をそのまま使う
+ * quality 1-: 2段で間引く
+ *   1段目: 3次CICで 1/decim_ に間引く(整数演算)
+ *   2段目: 窓付きsincのポリフェーズFIRで出力レートへ。quality が大きい
+ *          ほど遷移帯域が狭く、タップ数が多い
+ * 位置は32bit固定小数点で追跡するので、フレームをまたいでも端数は失わ
+ * れない
+ */
+class Resampler{
+public:
+    static constexpr int QUALITY_MAX = JUNKNES_MIXER_QUALITY_MAX;
+
+    Resampler(double in_rate, int out_rate, int quality);
+
+    // len サイクル分の入力に対する出力サンプル数の上限
+    int maxOutput(int len) const;
+
+    // 1フレーム分をミックスして間引き、出力レベル [0,1) を out に書く
+    // out には maxOutput() 以上の領域が必要。書いたサンプル数を返す
+    int process(const JunknesSound& sound, float* out);
+
+private:
+    int processPoint(const JunknesSound& sound, float* out);
+    int processFir(const JunknesSound& sound, float* out);
+    template<int D> void runCic(const JunknesSound& sound);
+    float dot(const float* x, const float* h) const;
+
+    static constexpr int PHASE_BITS = 5; // 2段目の位相の分解能
+    static constexpr int PHASES     = 1 << PHASE_BITS;
+    static constexpr int MIX_BITS   = 16; // 1段目の入力の固定小数点
+    static constexpr int HIST_FRAMES = 4; // hist_ を詰める間隔(フレーム数)の目安
+
+    int quality_;
+    int decim_; // 1段目の間引き率
+    int taps_;  // 2段目のタップ数(8の倍数)
+
+    // 出力1サンプルあたりの入力サンプル数(2段目の入力単位、32bit固定小数点)
+    std::uint64_t step_;
+    // 次の出力の位置(同上)。quality 0 ならフレーム先頭から、それ以外は
+    // hist_ の先頭から
+    std::uint64_t pos_;
+
+    // 1段目の状態。オーバーフローしても結果は正しい(符号なしで計算)
+    std::array<std::uint32_t, 3> integ_;
+    std::array<std::uint32_t, 3> comb_;
+    int decimCount_;
+    float cicScale_; // CICのゲインと MIX_BITS を打ち消す
+
+    std::vector<float> hist_;   // 2段目の入力
+    std::vector<float> kernel_; // [PHASES][taps_]
+
+    std::array<std::int32_t, 31>  mixPulse_; // APU_MIX_* の固定小数点版
+    std::array<std::int32_t, 203> mixTnd_;
+};
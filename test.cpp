@@ -0,0 +1,751 @@
+/**
+ * 設定によってCPUから見た動作が変わらないことの確認
+ *
+ * 合成したROMを設定ごとに同じフレーム数だけ実行し、命令ごとのCPU状態
+ * (junknes_before_exec() で取得)と各フレーム終了時のRAMが基準の設定と
+ * 一致するかを調べる。一致しなければ非0で終了する
+ *
+ * フックを設定するとCPUは別の実行ループを使い、アイドルループの早送り
+ * もしないので、各設定をフックなしでも実行する。この場合はフレームごと
+ * のRAMと、最後に1命令だけフックを設定して取ったCPU状態を比べる
+ *
+ * PPUの描画方式(PpuRenderer)は BasicPpu を直接使い、同じ操作をした2つ
+ * のインスタンスの出力と状態を比べる
+ */
+
+#include <array>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cassert>
+#include <initializer_list>
+
+#include "junknes.h"
+#include "ppu.hpp"
+#include "ppu-impl.hpp"
+
+using namespace std;
+
+namespace{
+    constexpr int FRAMES = 300;
+
+    struct Rom{
+        array<uint8_t, 0x8000> prg;
+        array<uint8_t, 0x2000> chr;
+        JunknesMirroring mirror;
+    };
+
+    /**
+     * PRGを組み立てる最低限のアセンブラ
+     * 命令はバイト列で直接書く。分岐先とジャンプ先だけラベルで指定できる
+     */
+    class Asm{
+    public:
+        explicit Asm(array<uint8_t, 0x8000>& prg) : prg_(prg), pc_(0x8000) {}
+
+        void label(const char* name)
+        {
+            assert(!labels_.count(name));
+            labels_[name] = pc_;
+        }
+
+        void op(initializer_list<int> bytes)
+        {
+            for(int b : bytes) emit(b);
+        }
+
+        // 相対分岐
+        void br(int opcode, const char* name)
+        {
+            emit(opcode);
+            fixups_.push_back({ pc_, name, true });
+            emit(0);
+        }
+
+        // 絶対アドレス(JMP/JSR)
+        void ab(int opcode, const char* name)
+        {
+            emit(opcode);
+            fixups_.push_back({ pc_, name, false });
+            emit(0);
+            emit(0);
+        }
+
+        // ラベルを解決し、割り込みベクタを設定する
+        void finish(const char* nmi, const char* reset, const char* irq)
+        {
+            for(const auto& fix : fixups_){
+                assert(labels_.count(fix.name));
+                int target = labels_[fix.name];
+                if(fix.relative){
+                    int disp = target - (fix.addr+1);
+                    assert(-128 <= disp && disp < 128);
+                    at(fix.addr) = static_cast<uint8_t>(disp);
+                }
+                else{
+                    at(fix.addr)   = target & 0xFF;
+                    at(fix.addr+1) = target >> 8;
+                }
+            }
+
+            setVector(0xFFFA, nmi);
+            setVector(0xFFFC, reset);
+            setVector(0xFFFE, irq);
+        }
+
+    private:
+        struct Fixup{
+            int addr;
+            string name;
+            bool relative;
+        };
+
+        uint8_t& at(int addr)
+        {
+            assert(0x8000 <= addr && addr < 0x10000);
+            return prg_[addr - 0x8000];
+        }
+
+        void emit(int b)
+        {
+            at(pc_++) = static_cast<uint8_t>(b);
+        }
+
+        void setVector(int addr, const char* name)
+        {
+            assert(labels_.count(name));
+            at(addr)   = labels_[name] & 0xFF;
+            at(addr+1) = labels_[name] >> 8;
+        }
+
+        array<uint8_t, 0x8000>& prg_;
+        int pc_;
+        map<string, int> labels_;
+        vector<Fixup> fixups_;
+    };
+
+    /**
+     * PPUの状態をポーリングするROM
+     *
+     * 全面がタイル1(不透明)の背景にスプライト0を置き、毎フレーム
+     *   - $2002 のスプライト0ヒットを待つ(待った回数をRAMに記録)
+     *   - ヒット直後にスクロールを書き換える
+     *   - $2003/$2004 でOAMを書き換え、読み返す
+     * を行う。スプライト0のY座標はNMIで毎フレーム変え、同じラインに10個
+     * 並べたスプライトでスプライトオーバーフローも立てる
+     */
+    Rom makePpuRom()
+    {
+        Rom rom;
+        rom.prg.fill(0xEA);
+        rom.chr.fill(0);
+        rom.mirror = JUNKNES_MIRROR_V;
+
+        // タイル1: 全ピクセルが色1
+        for(int i = 0; i < 8; ++i)
+            rom.chr[0x10 + i] = 0xFF;
+
+        Asm a(rom.prg);
+
+        a.label("reset");
+        a.op({ 0x78 });                         // SEI
+        a.op({ 0xD8 });                         // CLD
+        a.op({ 0xA2, 0xFF });                   // LDX #$FF
+        a.op({ 0x9A });                         // TXS
+        a.op({ 0xA9, 0x00 });                   // LDA #$00
+        a.op({ 0x8D, 0x00, 0x20 });             // STA $2000
+        a.op({ 0x8D, 0x01, 0x20 });             // STA $2001
+        a.label("vwait1");
+        a.op({ 0x2C, 0x02, 0x20 });             // BIT $2002
+        a.br(0x10, "vwait1");                   // BPL vwait1
+        a.label("vwait2");
+        a.op({ 0x2C, 0x02, 0x20 });             // BIT $2002
+        a.br(0x10, "vwait2");                   // BPL vwait2
+
+        // パレット
+        a.op({ 0xA9, 0x3F });                   // LDA #$3F
+        a.op({ 0x8D, 0x06, 0x20 });             // STA $2006
+        a.op({ 0xA9, 0x00 });                   // LDA #$00
+        a.op({ 0x8D, 0x06, 0x20 });             // STA $2006
+        a.op({ 0xA2, 0x00 });                   // LDX #$00
+        a.label("palette");
+        a.op({ 0x8E, 0x07, 0x20 });             // STX $2007
+        a.op({ 0xE8 });                         // INX
+        a.op({ 0xE0, 0x20 });                   // CPX #$20
+        a.br(0xD0, "palette");                  // BNE palette
+
+        // ネームテーブル0 (属性テーブル含む)をタイル1で埋める
+        a.op({ 0xA9, 0x20 });                   // LDA #$20
+        a.op({ 0x8D, 0x06, 0x20 });             // STA $2006
+        a.op({ 0xA9, 0x00 });                   // LDA #$00
+        a.op({ 0x8D, 0x06, 0x20 });             // STA $2006
+        a.op({ 0xA9, 0x01 });                   // LDA #$01
+        a.op({ 0xA0, 0x04 });                   // LDY #$04
+        a.op({ 0xA2, 0x00 });                   // LDX #$00
+        a.label("nametable");
+        a.op({ 0x8D, 0x07, 0x20 });             // STA $2007
+        a.op({ 0xE8 });                         // INX
+        a.br(0xD0, "nametable");                // BNE nametable
+        a.op({ 0x88 });                         // DEY
+        a.br(0xD0, "nametable");                // BNE nametable
+
+        // OAM ($0200): スプライト0と、Y=$60 に並べたスプライト1-10
+        a.op({ 0xA9, 0xF0 });                   // LDA #$F0
+        a.label("oamclear");
+        a.op({ 0x9D, 0x00, 0x02 });             // STA $0200,X
+        a.op({ 0xE8 });                         // INX
+        a.br(0xD0, "oamclear");                 // BNE oamclear
+        a.op({ 0xA9, 0x40 });                   // LDA #$40
+        a.op({ 0x8D, 0x00, 0x02 });             // STA $0200
+        a.op({ 0xA9, 0x01 });                   // LDA #$01
+        a.op({ 0x8D, 0x01, 0x02 });             // STA $0201
+        a.op({ 0xA9, 0x00 });                   // LDA #$00
+        a.op({ 0x8D, 0x02, 0x02 });             // STA $0202
+        a.op({ 0xA9, 0x80 });                   // LDA #$80
+        a.op({ 0x8D, 0x03, 0x02 });             // STA $0203
+        a.op({ 0xA2, 0x04 });                   // LDX #$04
+        a.op({ 0xA0, 0x0A });                   // LDY #$0A
+        a.label("sprites");
+        a.op({ 0xA9, 0x60 });                   // LDA #$60
+        a.op({ 0x9D, 0x00, 0x02 });             // STA $0200,X
+        a.op({ 0xA9, 0x01 });                   // LDA #$01
+        a.op({ 0x9D, 0x01, 0x02 });             // STA $0201,X
+        a.op({ 0xA9, 0x00 });                   // LDA #$00
+        a.op({ 0x9D, 0x02, 0x02 });             // STA $0202,X
+        a.op({ 0x8A });                         // TXA
+        a.op({ 0x0A });                         // ASL
+        a.op({ 0x9D, 0x03, 0x02 });             // STA $0203,X
+        a.op({ 0xE8, 0xE8, 0xE8, 0xE8 });       // INX x4
+        a.op({ 0x88 });                         // DEY
+        a.br(0xD0, "sprites");                  // BNE sprites
+
+        a.op({ 0xA9, 0x80 });                   // LDA #$80
+        a.op({ 0x8D, 0x00, 0x20 });             // STA $2000
+        a.op({ 0xA9, 0x1E });                   // LDA #$1E
+        a.op({ 0x8D, 0x01, 0x20 });             // STA $2001
+
+        a.label("main");
+        // 前フレームのスプライト0ヒットが落ちるのを待つ
+        a.label("hitclear");
+        a.op({ 0x2C, 0x02, 0x20 });             // BIT $2002
+        a.br(0x70, "hitclear");                 // BVS hitclear
+        // スプライト0ヒットを待ち、待った回数を $10 に
+        a.op({ 0xA2, 0x00 });                   // LDX #$00
+        a.label("hitwait");
+        a.op({ 0xE8 });                         // INX
+        a.op({ 0x2C, 0x02, 0x20 });             // BIT $2002
+        a.br(0x50, "hitwait");                  // BVC hitwait
+        a.op({ 0x86, 0x10 });                   // STX $10
+        a.op({ 0xAD, 0x02, 0x20 });             // LDA $2002
+        a.op({ 0x85, 0x12 });                   // STA $12
+        // 画面の途中でスクロール
+        a.op({ 0xA5, 0x11 });                   // LDA $11
+        a.op({ 0x8D, 0x05, 0x20 });             // STA $2005
+        a.op({ 0xA9, 0x00 });                   // LDA #$00
+        a.op({ 0x8D, 0x05, 0x20 });             // STA $2005
+        a.op({ 0xE6, 0x11 });                   // INC $11
+        // スプライト2のX座標を書き換えて読み返す
+        a.op({ 0xA9, 0x0B });                   // LDA #$0B
+        a.op({ 0x8D, 0x03, 0x20 });             // STA $2003
+        a.op({ 0xA5, 0x11 });                   // LDA $11
+        a.op({ 0x8D, 0x04, 0x20 });             // STA $2004
+        a.op({ 0xAD, 0x04, 0x20 });             // LDA $2004
+        a.op({ 0x85, 0x13 });                   // STA $13
+        // 待った回数の履歴を $0300- に
+        a.op({ 0xA4, 0x14 });                   // LDY $14
+        a.op({ 0x8A });                         // TXA
+        a.op({ 0x99, 0x00, 0x03 });             // STA $0300,Y
+        a.op({ 0xE6, 0x14 });                   // INC $14
+        a.ab(0x4C, "main");                     // JMP main
+
+        a.label("nmi");
+        a.op({ 0x48 });                         // PHA
+        a.op({ 0xE6, 0x15 });                   // INC $15
+        a.op({ 0xA9, 0x00 });                   // LDA #$00
+        a.op({ 0x8D, 0x03, 0x20 });             // STA $2003
+        a.op({ 0xA9, 0x02 });                   // LDA #$02
+        a.op({ 0x8D, 0x14, 0x40 });             // STA $4014
+        a.op({ 0xAD, 0x02, 0x20 });             // LDA $2002
+        a.op({ 0x85, 0x16 });                   // STA $16
+        a.op({ 0xA9, 0x00 });                   // LDA #$00
+        a.op({ 0x8D, 0x05, 0x20 });             // STA $2005
+        a.op({ 0x8D, 0x05, 0x20 });             // STA $2005
+        // 次フレームのスプライト0のY座標
+        a.op({ 0xA5, 0x15 });                   // LDA $15
+        a.op({ 0x29, 0x3F });                   // AND #$3F
+        a.op({ 0x18 });                         // CLC
+        a.op({ 0x69, 0x20 });                   // ADC #$20
+        a.op({ 0x8D, 0x00, 0x02 });             // STA $0200
+        a.op({ 0x68 });                         // PLA
+        a.label("irq");
+        a.op({ 0x40 });                         // RTI
+
+        a.finish("nmi", "reset", "irq");
+
+        return rom;
+    }
+
+
+    /**
+     * APUの状態をポーリングするROM
+     *
+     * 全チャンネルを短い長さカウンタで鳴らし、以下を繰り返す
+     *   - $4015 を256回読んで履歴を $0400- に記録し、長さカウンタが切れ
+     *     たチャンネルを鳴らし直す
+     *   - $4015 を読まずにNMIを2回待つ(読むとフレームIRQが解除されるた
+     *     め)。その前に $4017 のモードを0/1交互に書く
+     * DMCはIRQありで鳴らし、止まっていれば再開する(DMAでCPUが止まる)。
+     * IRQ(フレーム、DMC)の回数と $4015 の値も記録する。PPUは描画せずNMI
+     * だけ使う。NMI待ちはアイドルループなので、フックなしならAPUの遅延
+     * 処理を溜めたまま早送りされる
+     */
+    Rom makeApuRom()
+    {
+        Rom rom;
+        rom.prg.fill(0xEA);
+        rom.chr.fill(0);
+        rom.mirror = JUNKNES_MIRROR_V;
+
+        // DMCのサンプル ($C000-)
+        for(int i = 0; i < 0x100; ++i)
+            rom.prg[0x4000 + i] = static_cast<uint8_t>((i*37) ^ 0x5A);
+
+        Asm a(rom.prg);
+
+        a.label("reset");
+        a.op({ 0x78 });                         // SEI
+        a.op({ 0xD8 });                         // CLD
+        a.op({ 0xA2, 0xFF });                   // LDX #$FF
+        a.op({ 0x9A });                         // TXS
+        a.op({ 0xA9, 0x00 });                   // LDA #$00
+        a.op({ 0x8D, 0x01, 0x20 });             // STA $2001
+        a.op({ 0x8D, 0x17, 0x40 });             // STA $4017 (モード0、IRQあり)
+        a.op({ 0xA9, 0x80 });                   // LDA #$80
+        a.op({ 0x8D, 0x00, 0x20 });             // STA $2000
+        a.op({ 0xA9, 0x0F });                   // LDA #$0F
+        a.op({ 0x8D, 0x15, 0x40 });             // STA $4015
+
+        // 矩形波1: 長さ10
+        a.op({ 0xA9, 0x9F });                   // LDA #$9F
+        a.op({ 0x8D, 0x00, 0x40 });             // STA $4000
+        a.op({ 0xA9, 0x80 });                   // LDA #$80
+        a.op({ 0x8D, 0x02, 0x40 });             // STA $4002
+        a.op({ 0xA9, 0x00 });                   // LDA #$00
+        a.op({ 0x8D, 0x03, 0x40 });             // STA $4003
+        // 矩形波2
+        a.op({ 0xA9, 0x5F });                   // LDA #$5F
+        a.op({ 0x8D, 0x04, 0x40 });             // STA $4004
+        a.op({ 0xA9, 0x40 });                   // LDA #$40
+        a.op({ 0x8D, 0x06, 0x40 });             // STA $4006
+        a.ab(0x20, "restart");                  // JSR restart
+        // DMC: $C000 から241バイト
+        a.op({ 0xA9, 0x40 });                   // LDA #$40
+        a.op({ 0x8D, 0x11, 0x40 });             // STA $4011
+        a.op({ 0xA9, 0x00 });                   // LDA #$00
+        a.op({ 0x8D, 0x12, 0x40 });             // STA $4012
+        a.op({ 0xA9, 0x0F });                   // LDA #$0F
+        a.op({ 0x8D, 0x13, 0x40 });             // STA $4013
+        a.ab(0x20, "dmc");                      // JSR dmc
+        a.op({ 0x58 });                         // CLI
+
+        a.label("main");
+        a.op({ 0xA2, 0x00 });                   // LDX #$00
+        a.label("poll");
+        a.op({ 0xA4, 0x20 });                   // LDY $20
+        a.op({ 0xAD, 0x15, 0x40 });             // LDA $4015
+        a.op({ 0x99, 0x00, 0x04 });             // STA $0400,Y
+        a.op({ 0xE6, 0x20 });                   // INC $20
+        // 矩形波1が切れたら鳴らし直す
+        a.op({ 0x4A });                         // LSR
+        a.br(0xB0, "sq1");                      // BCS sq1
+        a.op({ 0xA9, 0x00 });                   // LDA #$00
+        a.op({ 0x8D, 0x03, 0x40 });             // STA $4003
+        a.op({ 0xE6, 0x21 });                   // INC $21
+        a.label("sq1");
+        // 他のチャンネルは全て切れたら
+        a.op({ 0xAD, 0x15, 0x40 });             // LDA $4015
+        a.op({ 0x29, 0x0E });                   // AND #$0E
+        a.br(0xD0, "others");                   // BNE others
+        a.ab(0x20, "restart");                  // JSR restart
+        a.label("others");
+        a.ab(0x20, "dmc");                      // JSR dmc
+        a.op({ 0xCA });                         // DEX
+        a.br(0xD0, "poll");                     // BNE poll
+
+        // $4017 のモードを切り替えて待つ
+        a.op({ 0xA5, 0x24 });                   // LDA $24
+        a.op({ 0x49, 0x80 });                   // EOR #$80
+        a.op({ 0x85, 0x24 });                   // STA $24
+        a.op({ 0x8D, 0x17, 0x40 });             // STA $4017
+        a.op({ 0xA0, 0x02 });                   // LDY #$02
+        a.label("quiet");
+        a.op({ 0xA5, 0x28 });                   // LDA $28
+        a.label("nmiwait");
+        a.op({ 0xC5, 0x28 });                   // CMP $28
+        a.br(0xF0, "nmiwait");                  // BEQ nmiwait
+        a.op({ 0x88 });                         // DEY
+        a.br(0xD0, "quiet");                    // BNE quiet
+        a.ab(0x4C, "main");                     // JMP main
+
+        // 矩形波2: 長さ40、三角波: 長さ4、ノイズ: 長さ6
+        a.label("restart");
+        a.op({ 0xA9, 0x20 });                   // LDA #$20
+        a.op({ 0x8D, 0x07, 0x40 });             // STA $4007
+        a.op({ 0xA9, 0x01 });                   // LDA #$01
+        a.op({ 0x8D, 0x08, 0x40 });             // STA $4008
+        a.op({ 0xA9, 0x40 });                   // LDA #$40
+        a.op({ 0x8D, 0x0A, 0x40 });             // STA $400A
+        a.op({ 0xA9, 0x28 });                   // LDA #$28
+        a.op({ 0x8D, 0x0B, 0x40 });             // STA $400B
+        a.op({ 0xA9, 0x1F });                   // LDA #$1F
+        a.op({ 0x8D, 0x0C, 0x40 });             // STA $400C
+        a.op({ 0xA9, 0x03 });                   // LDA #$03
+        a.op({ 0x8D, 0x0E, 0x40 });             // STA $400E
+        a.op({ 0xA9, 0x38 });                   // LDA #$38
+        a.op({ 0x8D, 0x0F, 0x40 });             // STA $400F
+        a.op({ 0xE6, 0x26 });                   // INC $26
+        a.op({ 0x60 });                         // RTS
+
+        // DMCが止まっていれば再開する
+        // $4015 の書き込みでIRQが無効になるので、$4010 はその後に書く
+        a.label("dmc");
+        a.op({ 0xAD, 0x15, 0x40 });             // LDA $4015
+        a.op({ 0x29, 0x10 });                   // AND #$10
+        a.br(0xD0, "dmcactive");                // BNE dmcactive
+        a.op({ 0xA9, 0x1F });                   // LDA #$1F
+        a.op({ 0x8D, 0x15, 0x40 });             // STA $4015
+        a.op({ 0xA9, 0x8F });                   // LDA #$8F
+        a.op({ 0x8D, 0x10, 0x40 });             // STA $4010
+        a.op({ 0xE6, 0x25 });                   // INC $25
+        a.label("dmcactive");
+        a.op({ 0x60 });                         // RTS
+
+        a.label("irq");
+        a.op({ 0x48 });                         // PHA
+        a.op({ 0xE6, 0x22 });                   // INC $22
+        a.op({ 0xAD, 0x15, 0x40 });             // LDA $4015
+        a.op({ 0x85, 0x23 });                   // STA $23
+        a.op({ 0x29, 0x40 });                   // AND #$40
+        a.br(0xF0, "noframe");                  // BEQ noframe
+        a.op({ 0xE6, 0x27 });                   // INC $27
+        a.label("noframe");
+        a.ab(0x20, "dmc");                      // JSR dmc
+        a.op({ 0x68 });                         // PLA
+        a.op({ 0x40 });                         // RTI
+
+        a.label("nmi");
+        a.op({ 0xE6, 0x28 });                   // INC $28
+        a.op({ 0x40 });                         // RTI
+
+        a.finish("nmi", "reset", "irq");
+
+        return rom;
+    }
+
+
+    // 1フレーム分の記録
+    struct Record{
+        uint64_t trace;      // 命令ごとのCPU状態のハッシュ(フックなしなら0)
+        unsigned long count; // 命令数(フックなしなら0)
+        array<uint8_t, 0x800> ram;
+    };
+
+    // 1回の実行の記録
+    struct Result{
+        vector<Record> frames;
+        uint64_t last; // 最後のフレームの後の最初の命令のCPU状態のハッシュ
+    };
+
+    uint64_t fnv1a(const uint8_t* data, size_t len, uint64_t hash)
+    {
+        for(size_t i = 0; i < len; ++i){
+            hash ^= data[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    uint64_t hashState(const JunknesCpuState* state, uint8_t opcode, uint16_t operand, uint64_t hash)
+    {
+        const uint8_t buf[] = {
+            static_cast<uint8_t>(state->PC & 0xFF), static_cast<uint8_t>(state->PC >> 8),
+            state->A, state->X, state->Y, state->S,
+            state->P.C, state->P.Z, state->P.I, state->P.D, state->P.V, state->P.N,
+            opcode, static_cast<uint8_t>(operand & 0xFF), static_cast<uint8_t>(operand >> 8),
+        };
+        return fnv1a(buf, sizeof(buf), hash);
+    }
+
+    void hookTrace(const JunknesCpuState* state, uint8_t opcode, uint16_t operand, void* userdata)
+    {
+        Record& rec = *static_cast<Record*>(userdata);
+
+        rec.trace = hashState(state, opcode, operand, rec.trace);
+        ++rec.count;
+    }
+
+    // 最初の1命令だけ記録する
+    void hookFirst(const JunknesCpuState* state, uint8_t opcode, uint16_t operand, void* userdata)
+    {
+        Result& result = *static_cast<Result*>(userdata);
+
+        if(result.last == 0)
+            result.last = hashState(state, opcode, operand, 14695981039346656037ULL);
+    }
+
+    struct Config{
+        const char* name;
+        void (*apply)(Junknes* nes, int frame); // 各フレームの前に呼ぶ
+    };
+
+    Result run(const Rom& rom, const Config& config, bool traced)
+    {
+        Junknes* nes = junknes_create(rom.prg.data(), rom.chr.data(), rom.mirror);
+
+        Result result;
+        result.frames.resize(FRAMES);
+        for(int frame = 0; frame < FRAMES; ++frame){
+            Record& rec = result.frames[frame];
+            rec.trace = traced ? 14695981039346656037ULL : 0;
+            rec.count = 0;
+            if(traced) junknes_before_exec(nes, hookTrace, &rec);
+
+            config.apply(nes, frame);
+            junknes_emulate_frame(nes);
+
+            memcpy(rec.ram.data(), junknes_ram(nes), rec.ram.size());
+        }
+
+        // 終了時のCPU状態は次のフレームの最初の命令で取る
+        result.last = 0;
+        junknes_before_exec(nes, hookFirst, &result);
+        junknes_emulate_frame(nes);
+
+        junknes_destroy(nes);
+
+        return result;
+    }
+
+    // 違いがあった最初のフレーム(なければ -1)と、その内容
+    int compare(const Result& expect, const Result& actual, bool traced, const char*& what)
+    {
+        for(int frame = 0; frame < FRAMES; ++frame){
+            const Record& e = expect.frames[frame];
+            const Record& a = actual.frames[frame];
+            if(traced && (e.count != a.count || e.trace != a.trace)){
+                what = "cpu trace";
+                return frame;
+            }
+            if(e.ram != a.ram){
+                what = "ram";
+                return frame;
+            }
+        }
+
+        if(expect.last != actual.last){
+            what = "final cpu state";
+            return FRAMES;
+        }
+
+        return -1;
+    }
+
+    /**
+     * configs[0] をフックありで実行した記録を基準に、他の設定(フックあり)
+     * と全ての設定(フックなし)の記録が一致するか
+     */
+    bool check(const char* title, const Rom& rom, initializer_list<Config> configs)
+    {
+        const Config& base = *configs.begin();
+        Result expect = run(rom, base, true);
+
+        bool ok = true;
+        for(bool traced : { true, false }){
+            for(const Config& config : configs){
+                if(traced && &config == &base) continue;
+
+                Result actual = run(rom, config, traced);
+
+                const char* what = "";
+                int bad = compare(expect, actual, traced, what);
+                const char* hook = traced ? "" : " (no hook)";
+
+                if(bad < 0){
+                    printf("ok: %s: %s%s == %s\n", title, config.name, hook, base.name);
+                }
+                else{
+                    printf("NG: %s: %s%s != %s (%s, frame %d)\n", title, config.name, hook, base.name, what, bad);
+                    ok = false;
+                }
+            }
+        }
+
+        return ok;
+    }
+
+
+    bool testRenderMode()
+    {
+        Rom rom = makePpuRom();
+
+        return check("render mode", rom, {
+            { "full", [](Junknes*, int){} },
+            { "skip2", [](Junknes* nes, int frame){
+                if(frame == 0) junknes_set_render_mode(nes, 2);
+            }},
+            { "off", [](Junknes* nes, int frame){
+                if(frame == 0) junknes_set_render_mode(nes, JUNKNES_RENDER_OFF);
+            }},
+            // 途中で切り替えても同じ
+            { "switching", [](Junknes* nes, int frame){
+                static const int MODES[] = { JUNKNES_RENDER_FULL, 1, JUNKNES_RENDER_OFF, 3 };
+                if(frame % 50 == 0) junknes_set_render_mode(nes, MODES[frame/50 % 4]);
+            }},
+        });
+    }
+
+    bool testAudioMode()
+    {
+        Rom rom = makeApuRom();
+
+        return check("audio mode", rom, {
+            { "on", [](Junknes*, int){} },
+            { "off", [](Junknes* nes, int frame){
+                if(frame == 0) junknes_set_audio_mode(nes, JUNKNES_AUDIO_OFF);
+            }},
+            { "blip", [](Junknes* nes, int frame){
+                if(frame == 0) junknes_set_sample_rate(nes, 44100);
+            }},
+            { "blip+off", [](Junknes* nes, int frame){
+                if(frame == 0){
+                    junknes_set_sample_rate(nes, 44100);
+                    junknes_set_audio_mode(nes, JUNKNES_AUDIO_OFF);
+                }
+            }},
+            // 途中で切り替えても同じ
+            { "switching", [](Junknes* nes, int frame){
+                if(frame % 37 == 0)
+                    junknes_set_audio_mode(nes, frame/37 % 2 ? JUNKNES_AUDIO_ON : JUNKNES_AUDIO_OFF);
+            }},
+        });
+    }
+
+
+    // PPUが外部から読む: CHR (パターンテーブル)とネームテーブル(垂直ミラー)
+    class TestPpuDoor{
+    public:
+        TestPpuDoor(const uint8_t* chr, uint8_t* vram) : chr_(chr), vram_(vram) {}
+
+        uint8_t readPpu(uint16_t addr)
+        {
+            if(addr < 0x2000) return chr_[addr];
+            return vram_[addr & 0x7FF];
+        }
+        void writePpu(uint16_t addr, uint8_t value)
+        {
+            if(addr >= 0x2000) vram_[addr & 0x7FF] = value;
+        }
+        void triggerNmi() {}
+
+    private:
+        const uint8_t* chr_;
+        uint8_t* vram_;
+    };
+
+    /**
+     * 乱数で埋めたCHR/VRAM/OAM/パレットで、LINE と DOT の各ラインの出力と
+     * regV が一致するか。ラインの間に $2000/$2001/$2005/$2006 をランダム
+     * に書き、スプライト数の制限の有無も切り替える
+     */
+    bool testPpuRenderer()
+    {
+        constexpr int PPU_FRAMES = 20;
+
+        uint64_t seed = UINT64_C(0x9E3779B97F4A7C15);
+        auto rnd = [&]{
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            return static_cast<uint8_t>(seed >> 32);
+        };
+
+        array<uint8_t, 0x2000> chr;
+        array<uint8_t, 0x800> vram;
+        array<uint8_t, 0x100> oam;
+        for(auto& b : chr) b = rnd();
+        for(auto& b : vram) b = rnd();
+
+        using TestPpu = BasicPpu<TestPpuDoor>;
+        auto door = make_shared<TestPpuDoor>(chr.data(), vram.data());
+        TestPpu line_ppu(door);
+        TestPpu dot_ppu(door);
+        TestPpu* ppus[] = { &line_ppu, &dot_ppu };
+        for(TestPpu* ppu : ppus){
+            ppu->hardReset();
+            ppu->decodeChr(chr.data());
+            ppu->mapNametables({{ vram.data(), vram.data()+0x400, vram.data(), vram.data()+0x400 }});
+        }
+
+        vector<uint8_t> line_buf(256), dot_buf(256);
+        for(int frame = 0; frame < PPU_FRAMES; ++frame){
+            for(auto& b : oam) b = rnd();
+            bool limit = frame % 2;
+            for(TestPpu* ppu : ppus){
+                ppu->setSpriteLimit(limit);
+                ppu->oamDma(oam.data());
+            }
+            for(int i = 0; i < 0x20; ++i){
+                uint8_t value = rnd() & 0x3F;
+                for(TestPpu* ppu : ppus) ppu->writePltram(0x3F00 + i, value);
+            }
+
+            for(TestPpu* ppu : ppus) ppu->reloadAddr();
+            for(int line = 0; line < 240; ++line){
+                // レジスタを書き換える(同じ値を両方に)
+                uint8_t op = rnd();
+                uint8_t value = rnd();
+                for(TestPpu* ppu : ppus){
+                    switch(op & 7){
+                    case 0: ppu->write2000(value); break;
+                    case 1: ppu->write2001(value & 0x1E); break;
+                    case 2: ppu->write2005(value); break;
+                    case 3: ppu->write2006(value); break;
+                    default: break;
+                    }
+                }
+
+                for(TestPpu* ppu : ppus) ppu->startLine();
+                line_ppu.doLine<PpuRenderer::LINE>(line, line_buf.data());
+                dot_ppu.doLine<PpuRenderer::DOT>(line, dot_buf.data());
+                for(TestPpu* ppu : ppus) ppu->endLine();
+
+                PpuRenderState line_st, dot_st;
+                line_ppu.saveRenderState(line_st);
+                dot_ppu.saveRenderState(dot_st);
+                if(line_buf != dot_buf || line_st.regV != dot_st.regV){
+                    printf("NG: ppu renderer: dot != line (%s, frame %d, line %d)\n",
+                           line_buf != dot_buf ? "pixels" : "regV", frame, line);
+                    return false;
+                }
+            }
+        }
+
+        printf("ok: ppu renderer: dot == line\n");
+        return true;
+    }
+}
+
+int main()
+{
+    bool ok = true;
+
+    ok &= testRenderMode();
+    ok &= testAudioMode();
+    ok &= testPpuRenderer();
+
+    return ok ? 0 : 1;
+}